@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "blockcompare.hpp"
+
+// Compares compareBlocks() with the std::mismatch scan verification used before it, on a 1 MiB chunk that
+// stays in cache and on a large buffer streamed from memory. Both fill the same per-block difference mask.
+//
+// Usage: blockcompare_bench [large buffer MiB, default 256] [passes, default 5]
+
+namespace {
+
+// The previous approach: find the next differing byte with std::mismatch and continue after its block
+uint64_t mismatchBlocks(const char* a, const char* b, uint64_t len, uint64_t* mask) {
+    std::memset(mask, 0, (len / COMPARE_BLOCK_SIZE + 64) / 64 * sizeof(uint64_t));
+    uint64_t differing = 0;
+    uint64_t offset = 0;
+    while (offset < len) {
+        const char* diff = std::mismatch(a + offset, a + len, b + offset).first;
+        if (diff == a + len)
+            break;
+        uint64_t block = static_cast<uint64_t>(diff - a) / COMPARE_BLOCK_SIZE;
+        mask[block / 64] |= uint64_t{1} << (block % 64);
+        differing++;
+        offset = (block + 1) * COMPARE_BLOCK_SIZE;
+    }
+    return differing;
+}
+
+using CompareFn = uint64_t (*)(const char*, const char*, uint64_t, uint64_t*);
+
+// Best of several passes over len bytes, repeated so every pass covers at least 1 GiB, in GB/s
+double throughput(CompareFn compare, const char* a, const char* b, uint64_t len, uint64_t* mask, int passes, uint64_t& differing) {
+    uint64_t repeats = std::max<uint64_t>(1, (uint64_t{1} << 30) / len);
+    double best = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t r = 0; r < repeats; r++) {
+            differing = compare(a, b, len, mask);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, static_cast<double>(len * repeats) / elapsed / 1e9);
+    }
+    return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t largeSize = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256) * 1024 * 1024;
+    int passes = argc > 2 ? std::atoi(argv[2]) : 5;
+    if (largeSize == 0 || passes < 1) {
+        std::fprintf(stderr, "Usage: %s [large buffer MiB, at least 1] [passes, at least 1]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<char> a(largeSize);
+    for (uint64_t i = 0; i < a.size(); i++) {
+        a[i] = static_cast<char>(i * 2654435761u >> 24);
+    }
+    std::vector<char> b = a;
+    std::vector<uint64_t> mask((largeSize / COMPARE_BLOCK_SIZE + 64) / 64);
+    std::vector<uint64_t> expected(mask.size());
+
+    std::printf("%-22s %12s %12s %10s\n", "case", "mismatch", compareBlocksKernel(), "speedup");
+    for (uint64_t len : {uint64_t{1024 * 1024}, largeSize}) {
+        // Identical buffers are the common case; one differing block in 4096 covers the repair path
+        for (bool withDiffs : {false, true}) {
+            std::copy(a.begin(), a.end(), b.begin());
+            if (withDiffs) {
+                for (uint64_t offset = 1234; offset < len; offset += 4096 * COMPARE_BLOCK_SIZE) {
+                    b[offset] ^= 1;
+                }
+            }
+            uint64_t oldDiffering = 0;
+            uint64_t newDiffering = 0;
+            double old = throughput(mismatchBlocks, a.data(), b.data(), len, expected.data(), passes, oldDiffering);
+            double simd = throughput(compareBlocks, a.data(), b.data(), len, mask.data(), passes, newDiffering);
+            uint64_t words = (len / COMPARE_BLOCK_SIZE + 64) / 64;
+            if (oldDiffering != newDiffering || !std::equal(mask.begin(), mask.begin() + words, expected.begin())) {
+                std::fprintf(stderr, "Kernels disagree on %lu bytes\n", len);
+                return 1;
+            }
+            char name[64];
+            std::snprintf(name, sizeof(name), "%lu MiB%s", len >> 20, withDiffs ? ", differing" : "");
+            std::printf("%-22s %9.2f GB/s %7.2f GB/s %9.1fx\n", name, old, simd, simd / old);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "busemanager.hpp"
+#include "crc32c.hpp"
+
+// Measures the CRC32C kernel and what per-block checksums cost the write path: the same writes are timed
+// through prepareWrite(), the copy and markDirty() with checksums off and then on.
+//
+// Usage: crc32c_bench [device MiB, default 256] [passes, default 5]
+
+namespace {
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Writes the whole device once in requests of writeSize bytes, as the NBD write handler does
+void writePass(BuseManager& manager, const char* data, uint64_t writeSize) {
+    char* buffer = BuseManager::buffer.get();
+    for (uint64_t offset = 0; offset + writeSize <= manager.getBufferSize(); offset += writeSize) {
+        RangeGuard lock(BuseManager::rangeLocks, offset, writeSize, true);
+        manager.prepareWrite(offset, writeSize);
+        std::memcpy(buffer + offset, data, writeSize);
+        manager.markDirty(offset, writeSize);
+    }
+}
+
+// Best of several passes, in GB/s
+double writeThroughput(BuseManager& manager, const char* data, uint64_t writeSize, int passes) {
+    double best = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        writePass(manager, data, writeSize);
+        best = std::max(best, manager.getBufferSize() / seconds(start) / 1e9);
+    }
+    return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256) * 1024 * 1024;
+    int passes = argc > 2 ? std::atoi(argv[2]) : 5;
+    if (size == 0 || passes < 1) {
+        std::fprintf(stderr, "Usage: %s [device MiB, at least 1] [passes, at least 1]\n", argv[0]);
+        return 1;
+    }
+    loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+
+    std::vector<char> data(1024 * 1024);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 2654435761u >> 24);
+    }
+
+    uint32_t sink = 0;
+    double best = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 1024; i++) {
+            sink ^= crc32c(data.data(), data.size());
+        }
+        best = std::max(best, 1024.0 * data.size() / seconds(start) / 1e9);
+    }
+    std::printf("crc32c %s kernel: %.2f GB/s (%08x)\n", crc32cKernel(), best, sink);
+
+    BuseManager manager(size);
+    writePass(manager, data.data(), data.size());  // Fault in the pages, so no pass pays for them
+
+    const uint64_t writeSizes[] = {4096, 64 * 1024, 1024 * 1024};
+    std::vector<double> plain;
+    for (uint64_t writeSize : writeSizes) {
+        plain.push_back(writeThroughput(manager, data.data(), writeSize, passes));
+    }
+    manager.enableChecksums();
+    std::printf("%10s %14s %14s %10s\n", "write", "plain GB/s", "checked GB/s", "overhead");
+    for (size_t i = 0; i < plain.size(); i++) {
+        double checked = writeThroughput(manager, data.data(), writeSizes[i], passes);
+        std::printf("%10lu %14.2f %14.2f %9.1f%%\n", writeSizes[i], plain[i], checked, (plain[i] / checked - 1) * 100);
+    }
+    return 0;
+}
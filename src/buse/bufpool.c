@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bufpool.h"
+
+struct bufpool {
+    char* base;
+    size_t size;  /* bytes per buffer */
+    size_t count;
+    size_t mapped;
+
+    /* Stack of free buffer indices. Buffers are released from whichever
+     * thread completes the request, hence the lock. */
+    pthread_mutex_t lock;
+    size_t* free_list;
+    size_t free_count;
+};
+
+static u_int64_t pool_hits;
+static u_int64_t pool_misses;
+
+struct bufpool* bufpool_create(size_t count, size_t size, int hugepages) {
+    struct bufpool* pool;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t i;
+
+    if (count == 0 || size == 0)
+        return NULL;
+
+    pool = calloc(1, sizeof(*pool));
+    assert(pool);
+    pool->size = (size + page - 1) / page * page;
+    pool->count = count;
+    pool->mapped = pool->size * count;
+
+    pool->base = MAP_FAILED;
+    if (hugepages) {
+        pool->base = mmap(NULL, pool->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pool->base == MAP_FAILED)
+            warnx("no hugetlb pages for the buffer pool, asking for transparent hugepages");
+    }
+    if (pool->base == MAP_FAILED) {
+        pool->base = mmap(NULL, pool->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pool->base == MAP_FAILED) {
+            warn("failed to map buffer pool");
+            free(pool);
+            return NULL;
+        }
+        if (hugepages)
+            madvise(pool->base, pool->mapped, MADV_HUGEPAGE);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->free_list = malloc(count * sizeof(*pool->free_list));
+    assert(pool->free_list);
+    for (i = 0; i < count; i++)
+        pool->free_list[i] = count - 1 - i;
+    pool->free_count = count;
+    return pool;
+}
+
+void bufpool_destroy(struct bufpool* pool) {
+    if (!pool)
+        return;
+    assert(pool->free_count == pool->count);
+    munmap(pool->base, pool->mapped);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->free_list);
+    free(pool);
+}
+
+void* bufpool_get(struct bufpool* pool, size_t len) {
+    void* buf = NULL;
+
+    if (pool && len <= pool->size) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->free_count > 0)
+            buf = pool->base + pool->free_list[--pool->free_count] * pool->size;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (buf) {
+        __atomic_fetch_add(&pool_hits, 1, __ATOMIC_RELAXED);
+        return buf;
+    }
+
+    __atomic_fetch_add(&pool_misses, 1, __ATOMIC_RELAXED);
+    if (posix_memalign(&buf, (size_t)sysconf(_SC_PAGESIZE), len ? len : 1) != 0)
+        return NULL;
+    return buf;
+}
+
+void bufpool_put(struct bufpool* pool, void* buf) {
+    char* p = buf;
+
+    if (pool && p >= pool->base && p < pool->base + pool->mapped) {
+        pthread_mutex_lock(&pool->lock);
+        pool->free_list[pool->free_count++] = (size_t)(p - pool->base) / pool->size;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    free(buf);
+}
+
+void bufpool_counters(u_int64_t* hits, u_int64_t* misses) {
+    *hits = __atomic_load_n(&pool_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&pool_misses, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,27 @@
+#ifndef BUSE_BUFPOOL_H_INCLUDED
+#define BUSE_BUFPOOL_H_INCLUDED
+
+/*
+ * Fixed pool of page-aligned I/O buffers, so that serving a request does not
+ * go through the allocator. Requests larger than the pool buffer size, or
+ * arriving while every buffer is in use, get a one-off allocation instead and
+ * are counted as misses.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct bufpool;
+
+/* Returns NULL if count is 0 or the pool memory cannot be mapped. */
+struct bufpool* bufpool_create(size_t count, size_t size, int hugepages);
+void bufpool_destroy(struct bufpool* pool);
+
+/* Both accept a NULL pool, in which case every buffer is a miss. */
+void* bufpool_get(struct bufpool* pool, size_t len);
+void bufpool_put(struct bufpool* pool, void* buf);
+
+/* Process-wide totals over every pool. */
+void bufpool_counters(u_int64_t* hits, u_int64_t* misses);
+
+#endif /* BUSE_BUFPOOL_H_INCLUDED */
@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <linux/nbd.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,15 +33,44 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "buse.h"
+#include "bufpool.h"
+#ifdef BUSE_HAVE_IO_URING
+#include "uring.h"
+#endif
 
 #ifndef BUSE_DEBUG
 #define BUSE_DEBUG (0)
 #endif
 
+/* Older kernel headers predate write zeroes, the values are fixed by the
+ * NBD protocol. */
+#ifndef NBD_FLAG_SEND_WRITE_ZEROES
+#define NBD_FLAG_SEND_WRITE_ZEROES (1 << 6)
+#define NBD_CMD_WRITE_ZEROES (6)
+#endif
+
+/* The upper bits of a request type carry command flags such as FUA. */
+#define NBD_CMD_MASK (0xffff)
+#ifndef NBD_CMD_FLAG_FUA
+#define NBD_CMD_FLAG_FUA (1 << 16)
+#endif
+#ifndef NBD_FLAG_SEND_FUA
+#define NBD_FLAG_SEND_FUA (1 << 3)
+#endif
+#ifndef NBD_CMD_FLAG_NO_HOLE
+#define NBD_CMD_FLAG_NO_HOLE (1 << 17)
+#endif
+
+/* Buffer pool defaults, sized for the largest request the kernel sends with
+ * its default max_sectors_kb. */
+#define BUSE_POOL_BUFFERS (32)
+#define BUSE_POOL_BUFFER_SIZE (1024 * 1024)
+
 /*
  * These helper functions were taken from cliserv.h in the nbd distribution.
  */
@@ -73,16 +103,27 @@ static int read_all(int fd, char* buf, size_t count) {
     return 0;
 }
 
-static int write_all(int fd, char* buf, size_t count) {
-    int bytes_written;
+/* Drops the first bytes of an iovec array once they have been written. */
+static void advance_iov(struct iovec** iov, int* iovcnt, size_t bytes) {
+    while (*iovcnt > 0 && bytes >= (*iov)->iov_len) {
+        bytes -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt > 0) {
+        (*iov)->iov_base = (char*)(*iov)->iov_base + bytes;
+        (*iov)->iov_len -= bytes;
+    }
+}
 
-    while (count > 0) {
-        bytes_written = write(fd, buf, count);
+static int writev_all(int fd, struct iovec* iov, int iovcnt) {
+    ssize_t bytes_written;
+
+    while (iovcnt > 0) {
+        bytes_written = writev(fd, iov, iovcnt);
         assert(bytes_written > 0);
-        buf += bytes_written;
-        count -= bytes_written;
+        advance_iov(&iov, &iovcnt, (size_t)bytes_written);
     }
-    assert(count == 0);
 
     return 0;
 }
@@ -111,8 +152,219 @@ static int set_sigaction(int sig, const struct sigaction* act) {
     return r;
 }
 
+/* State shared by every connection of one device. */
+struct buse_server {
+    const struct buse_operations* aop;
+    void* userdata;
+    pthread_mutex_t lock;
+    int disconnected;
+};
+
+/* One userland socket of the device and the thread serving it. */
+struct buse_conn {
+    struct buse_server* server;
+    int sk;
+    int kernel_sk; /* the other end, handed to the kernel */
+    int status;
+    pthread_t thread;
+
+    /* Serializes replies, which asynchronous completions send from any thread,
+     * and protects the count of submitted requests not yet completed. */
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    unsigned inflight;
+
+    struct bufpool* pool;
+};
+
+/* Writes a reply header followed by len bytes of data as one unit. The data
+ * is gathered straight from where it lives, which for read_ref is the
+ * backend's own storage. */
+static void send_reply(struct buse_conn* conn, struct nbd_reply* reply, const void* data, u_int32_t len) {
+    struct iovec iov[2];
+
+    iov[0].iov_base = reply;
+    iov[0].iov_len = sizeof(struct nbd_reply);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = len;
+
+    pthread_mutex_lock(&conn->lock);
+    writev_all(conn->sk, iov, len ? 2 : 1);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/* Like send_reply for a read_ref payload whose lock read_end drops. The
+ * socket takes what it can without blocking straight from the backend's
+ * storage, the rest is copied to a pool buffer, and read_end is called before
+ * that is sent, so the lock is never held while the peer is slow to read. */
+static void send_reply_ref(struct buse_conn* conn, struct nbd_reply* reply, const void* data, u_int32_t len, u_int64_t from) {
+    struct iovec iov[2];
+    struct iovec* next = iov;
+    int iovcnt = len ? 2 : 1;
+    struct msghdr msg;
+    ssize_t sent;
+    char* rest = NULL;
+    size_t rest_len = 0;
+
+    iov[0].iov_base = reply;
+    iov[0].iov_len = sizeof(struct nbd_reply);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+
+    pthread_mutex_lock(&conn->lock);
+    while (iovcnt > 0) {
+        msg.msg_iov = next;
+        msg.msg_iovlen = iovcnt;
+        sent = sendmsg(conn->sk, &msg, MSG_DONTWAIT);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0) {
+            assert(errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+        advance_iov(&next, &iovcnt, (size_t)sent);
+    }
+    if (iovcnt > 0) {
+        for (int i = 0; i < iovcnt; i++)
+            rest_len += next[i].iov_len;
+        rest = bufpool_get(conn->pool, rest_len);
+        assert(rest);
+        rest_len = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(rest + rest_len, next[i].iov_base, next[i].iov_len);
+            rest_len += next[i].iov_len;
+        }
+    }
+    conn->server->aop->read_end(len, from, conn->server->userdata);
+    if (rest) {
+        struct iovec tail = {rest, rest_len};
+        writev_all(conn->sk, &tail, 1);
+        bufpool_put(conn->pool, rest);
+    }
+    pthread_mutex_unlock(&conn->lock);
+}
+
+void buse_complete(struct buse_request* req, int error) {
+    struct buse_conn* conn = req->conn;
+    struct nbd_reply reply;
+
+    reply.magic = htonl(NBD_REPLY_MAGIC);
+    reply.error = htonl(error);
+    memcpy(reply.handle, req->handle, sizeof(reply.handle));
+    if (req->data && error == 0 && conn->server->aop->read_end)
+        send_reply_ref(conn, &reply, req->data, req->len, req->from);
+    else
+        send_reply(conn, &reply, req->data ? req->data : req->buf, req->type == BUSE_CMD_READ && error == 0 ? req->len : 0);
+
+    if (req->buf)
+        bufpool_put(conn->pool, req->buf);
+    free(req);
+
+    pthread_mutex_lock(&conn->lock);
+    if (--conn->inflight == 0)
+        pthread_cond_broadcast(&conn->idle);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/* Blocks until every request handed to submit on this connection is completed. */
+static void wait_inflight(struct buse_conn* conn) {
+    pthread_mutex_lock(&conn->lock);
+    while (conn->inflight != 0)
+        pthread_cond_wait(&conn->idle, &conn->lock);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/* Makes a successful write durable before it is acknowledged when the kernel
+ * asked for forced unit access. */
+static int complete_fua(const struct buse_operations* aop, const struct nbd_request* request, int error, void* userdata) {
+    if (error == 0 && (ntohl(request->type) & NBD_CMD_FLAG_FUA) && aop->sync_range)
+        error = aop->sync_range(ntohll(request->from), ntohl(request->len), userdata);
+    return error;
+}
+
+/* Whether the next len bytes of the socket are already queued, so receiving
+ * them cannot wait on the network. */
+static int payload_queued(int sk, u_int32_t len) {
+    int queued;
+    return ioctl(sk, FIONREAD, &queued) == 0 && queued >= 0 && (u_int32_t)queued >= len;
+}
+
+/* Hands a request to the asynchronous submit callback. Returns 0 if the
+ * command is not one submit handles and should be served inline. */
+static int submit_request(struct buse_conn* conn, const struct nbd_request* request) {
+    struct buse_request* req;
+    enum buse_request_type type;
+    int err;
+
+    switch (ntohl(request->type) & NBD_CMD_MASK) {
+        case NBD_CMD_READ:
+            type = BUSE_CMD_READ;
+            break;
+        case NBD_CMD_WRITE:
+            type = BUSE_CMD_WRITE;
+            break;
+        case NBD_CMD_FLUSH:
+            type = BUSE_CMD_FLUSH;
+            break;
+        case NBD_CMD_TRIM:
+            type = BUSE_CMD_TRIM;
+            break;
+        case NBD_CMD_WRITE_ZEROES:
+            type = BUSE_CMD_WRITE_ZEROES;
+            break;
+        default:
+            return 0;
+    }
+
+    req = calloc(1, sizeof(*req));
+    assert(req);
+    req->type = type;
+    req->from = ntohll(request->from);
+    req->len = ntohl(request->len);
+    req->fua = (ntohl(request->type) & NBD_CMD_FLAG_FUA) != 0;
+    req->no_hole = (ntohl(request->type) & NBD_CMD_FLAG_NO_HOLE) != 0;
+    req->conn = conn;
+    memcpy(req->handle, request->handle, sizeof(req->handle));
+
+    /* A backend with read_ref serves reads by pointing req->data at its storage. */
+    if ((type == BUSE_CMD_READ && !conn->server->aop->read_ref) || type == BUSE_CMD_WRITE) {
+        req->buf = bufpool_get(conn->pool, req->len);
+        assert(req->buf);
+    }
+    /* The payload must be consumed before the next header can be read. */
+    if (type == BUSE_CMD_WRITE)
+        read_all(conn->sk, req->buf, req->len);
+
+    pthread_mutex_lock(&conn->lock);
+    conn->inflight++;
+    pthread_mutex_unlock(&conn->lock);
+
+    err = conn->server->aop->submit(req, conn->server->userdata);
+    if (err != 0)
+        buse_complete(req, err);
+    return 1;
+}
+
+/* The kernel sends NBD_CMD_DISC on every connection, report it only once. */
+static void handle_disconnect(struct buse_server* server) {
+    int first;
+
+    pthread_mutex_lock(&server->lock);
+    first = !server->disconnected;
+    server->disconnected = 1;
+    pthread_mutex_unlock(&server->lock);
+
+    if (first && server->aop->disc) {
+        server->aop->disc(server->userdata);
+    }
+}
+
 /* Serve userland side of nbd socket. If everything worked ok, return 0. */
-static int serve_nbd(int sk, const struct buse_operations* aop, void* userdata) {
+static int serve_nbd(struct buse_conn* conn) {
+    const struct buse_operations* aop = conn->server->aop;
+    void* userdata = conn->server->userdata;
+    int sk = conn->sk;
     u_int64_t from;
     u_int32_t len;
     ssize_t bytes_read;
@@ -132,7 +384,10 @@ static int serve_nbd(int sk, const struct buse_operations* aop, void* userdata)
         from = ntohll(request.from);
         assert(request.magic == htonl(NBD_REQUEST_MAGIC));
 
-        switch (ntohl(request.type)) {
+        if (aop->submit && submit_request(conn, &request))
+            continue;
+
+        switch (ntohl(request.type) & NBD_CMD_MASK) {
                 /* I may at some point need to deal with the the fact that the
                  * official nbd server has a maximum buffer size, and divides up
                  * oversized requests into multiple pieces. This applies to reads
@@ -141,27 +396,54 @@ static int serve_nbd(int sk, const struct buse_operations* aop, void* userdata)
             case NBD_CMD_READ:
                 if (BUSE_DEBUG)
                     fprintf(stderr, "Request for read of size %d\n", len);
+                if (aop->read_ref) {
+                    const void* data = NULL;
+                    int error = aop->read_ref(&data, len, from, userdata);
+                    reply.error = htonl(error);
+                    if (error == 0 && aop->read_end)
+                        send_reply_ref(conn, &reply, data, len, from);
+                    else
+                        send_reply(conn, &reply, data, error ? 0 : len);
+                    break;
+                }
                 /* Fill with zero in case actual read is not implemented */
-                chunk = malloc(len);
+                chunk = bufpool_get(conn->pool, len);
                 if (aop->read) {
-                    reply.error = aop->read(chunk, len, from, userdata);
+                    reply.error = htonl(aop->read(chunk, len, from, userdata));
                 } else {
                     /* If user not specified read operation, return EPERM error */
                     reply.error = htonl(EPERM);
                 }
-                write_all(sk, (char*)&reply, sizeof(struct nbd_reply));
-                write_all(sk, (char*)chunk, len);
+                send_reply(conn, &reply, chunk, reply.error ? 0 : len);
 
-                free(chunk);
+                bufpool_put(conn->pool, chunk);
                 break;
             case NBD_CMD_WRITE:
                 if (BUSE_DEBUG) {
                     fprintf(stderr, "Request for write of size %d\n", len);
                 }
-                chunk = malloc(len);
+                /* The backend may lock the range in write_begin, so the zero-copy
+                 * path is only taken when the payload cannot keep it waiting. */
+                if (aop->write_begin && aop->write_end && (!aop->write || payload_queued(sk, len))) {
+                    void* dest = NULL;
+                    int error = aop->write_begin(&dest, len, from, userdata);
+                    if (error == 0) {
+                        read_all(sk, dest, len);
+                        error = complete_fua(aop, &request, aop->write_end(len, from, userdata), userdata);
+                    } else {
+                        /* Drain the payload the backend refused. */
+                        chunk = bufpool_get(conn->pool, len);
+                        read_all(sk, chunk, len);
+                        bufpool_put(conn->pool, chunk);
+                    }
+                    reply.error = htonl(error);
+                    send_reply(conn, &reply, NULL, 0);
+                    break;
+                }
+                chunk = bufpool_get(conn->pool, len);
                 read_all(sk, chunk, len);
                 if (aop->write) {
-                    reply.error = aop->write(chunk, len, from, userdata);
+                    reply.error = htonl(complete_fua(aop, &request, aop->write(chunk, len, from, userdata), userdata));
                     if (BUSE_DEBUG) {
                         // print hexdump of the chunk
                         for (int i = 0; i < len; i++) {
@@ -173,25 +455,24 @@ static int serve_nbd(int sk, const struct buse_operations* aop, void* userdata)
                     /* If user not specified write operation, return EPERM error */
                     reply.error = htonl(EPERM);
                 }
-                free(chunk);
-                write_all(sk, (char*)&reply, sizeof(struct nbd_reply));
+                bufpool_put(conn->pool, chunk);
+                send_reply(conn, &reply, NULL, 0);
                 break;
             case NBD_CMD_DISC:
                 if (BUSE_DEBUG)
                     fprintf(stderr, "Got NBD_CMD_DISC\n");
-                /* Handle a disconnect request. */
-                if (aop->disc) {
-                    aop->disc(userdata);
-                }
+                /* Handle a disconnect request once everything in flight is answered. */
+                wait_inflight(conn);
+                handle_disconnect(conn->server);
                 return EXIT_SUCCESS;
 #ifdef NBD_FLAG_SEND_FLUSH
             case NBD_CMD_FLUSH:
                 if (BUSE_DEBUG)
                     fprintf(stderr, "Got NBD_CMD_FLUSH\n");
                 if (aop->flush) {
-                    reply.error = aop->flush(userdata);
+                    reply.error = htonl(aop->flush(userdata));
                 }
-                write_all(sk, (char*)&reply, sizeof(struct nbd_reply));
+                send_reply(conn, &reply, NULL, 0);
                 break;
 #endif
 #ifdef NBD_FLAG_SEND_TRIM
@@ -199,15 +480,26 @@ static int serve_nbd(int sk, const struct buse_operations* aop, void* userdata)
                 if (BUSE_DEBUG)
                     fprintf(stderr, "Got NBD_CMD_TRIM\n");
                 if (aop->trim) {
-                    reply.error = aop->trim(from, len, userdata);
+                    reply.error = htonl(aop->trim(from, len, userdata));
                 }
-                write_all(sk, (char*)&reply, sizeof(struct nbd_reply));
+                send_reply(conn, &reply, NULL, 0);
                 break;
 #endif
+            case NBD_CMD_WRITE_ZEROES:
+                if (BUSE_DEBUG)
+                    fprintf(stderr, "Got NBD_CMD_WRITE_ZEROES\n");
+                reply.error = htonl(aop->write_zeroes ? complete_fua(aop, &request, aop->write_zeroes(from, len, (ntohl(request.type) & NBD_CMD_FLAG_NO_HOLE) != 0, userdata), userdata) : EINVAL);
+                send_reply(conn, &reply, NULL, 0);
+                break;
             default:
-                assert(0);
+                /* Only commands without a payload can be negotiated without us. */
+                warnx("unsupported NBD command %u", ntohl(request.type));
+                reply.error = htonl(EINVAL);
+                send_reply(conn, &reply, NULL, 0);
+                break;
         }
     }
+    wait_inflight(conn);
     if (bytes_read == -1) {
         warn("error reading userside of nbd socket");
         return EXIT_FAILURE;
@@ -215,12 +507,365 @@ static int serve_nbd(int sk, const struct buse_operations* aop, void* userdata)
     return EXIT_SUCCESS;
 }
 
+#ifdef BUSE_HAVE_IO_URING
+/*
+ * io_uring event loop. Instead of one blocking read or write per header and
+ * payload, the socket is drained with large receives into a staging buffer,
+ * every complete request found there is served, and the replies collected
+ * meanwhile go out as a single sendmsg. One io_uring_enter both submits the
+ * batched send and the next receive, and waits for whichever finishes first.
+ */
+
+#define URING_ENTRIES 8
+#define URING_RX_SIZE (1024 * 1024)
+#define URING_TAG_RECV 1
+#define URING_TAG_SEND 2
+
+struct uring_reply {
+    struct nbd_reply reply;
+    const void* data;
+    u_int32_t len;
+    int owned; /* data is a pool buffer, released once sent */
+};
+
+/* Replies queued for one sendmsg. */
+struct uring_batch {
+    struct uring_reply* replies;
+    size_t count;
+    size_t cap;
+    struct iovec* iov;
+    size_t iov_cap;
+    struct msghdr msg;
+};
+
+struct uring_conn {
+    struct uring ring;
+    char* rx;
+    size_t rx_cap;
+    size_t rx_start;
+    size_t rx_end;
+    struct uring_batch batches[2];
+    struct uring_batch* pending;
+    struct uring_batch* sending;
+};
+
+static void batch_add(struct uring_batch* batch, const char* handle, int error, const void* data, u_int32_t len, int owned) {
+    struct uring_reply* r;
+
+    if (batch->count == batch->cap) {
+        batch->cap = batch->cap ? batch->cap * 2 : 64;
+        batch->replies = realloc(batch->replies, batch->cap * sizeof(*batch->replies));
+        assert(batch->replies);
+    }
+    r = &batch->replies[batch->count++];
+    r->reply.magic = htonl(NBD_REPLY_MAGIC);
+    r->reply.error = htonl(error);
+    memcpy(r->reply.handle, handle, sizeof(r->reply.handle));
+    r->data = data;
+    r->len = len;
+    r->owned = owned;
+}
+
+static void batch_release(struct bufpool* pool, struct uring_batch* batch) {
+    size_t i;
+
+    for (i = 0; i < batch->count; i++) {
+        if (batch->replies[i].owned)
+            bufpool_put(pool, (void*)batch->replies[i].data);
+    }
+    batch->count = 0;
+}
+
+static void uring_queue_recv(struct uring_conn* uc, int sk) {
+    struct io_uring_sqe* sqe;
+
+    /* Move a partial request to the front, and make room for large writes. */
+    if (uc->rx_start > 0) {
+        memmove(uc->rx, uc->rx + uc->rx_start, uc->rx_end - uc->rx_start);
+        uc->rx_end -= uc->rx_start;
+        uc->rx_start = 0;
+    }
+    if (uc->rx_end == uc->rx_cap) {
+        uc->rx_cap *= 2;
+        uc->rx = realloc(uc->rx, uc->rx_cap);
+        assert(uc->rx);
+    }
+
+    sqe = uring_get_sqe(&uc->ring);
+    assert(sqe);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sk;
+    sqe->addr = (unsigned long)(uc->rx + uc->rx_end);
+    sqe->len = uc->rx_cap - uc->rx_end;
+    sqe->user_data = URING_TAG_RECV;
+}
+
+static void uring_queue_send(struct uring_conn* uc, int sk) {
+    struct uring_batch* batch = uc->pending;
+    struct io_uring_sqe* sqe;
+    size_t i, n = 0;
+
+    if (batch->iov_cap < batch->count * 2) {
+        batch->iov_cap = batch->count * 2;
+        batch->iov = realloc(batch->iov, batch->iov_cap * sizeof(*batch->iov));
+        assert(batch->iov);
+    }
+    for (i = 0; i < batch->count; i++) {
+        batch->iov[n].iov_base = &batch->replies[i].reply;
+        batch->iov[n++].iov_len = sizeof(struct nbd_reply);
+        if (batch->replies[i].len) {
+            batch->iov[n].iov_base = (void*)batch->replies[i].data;
+            batch->iov[n++].iov_len = batch->replies[i].len;
+        }
+    }
+    memset(&batch->msg, 0, sizeof(batch->msg));
+    batch->msg.msg_iov = batch->iov;
+    batch->msg.msg_iovlen = n;
+
+    uc->pending = batch == &uc->batches[0] ? &uc->batches[1] : &uc->batches[0];
+    uc->sending = batch;
+
+    sqe = uring_get_sqe(&uc->ring);
+    assert(sqe);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sk;
+    sqe->addr = (unsigned long)&batch->msg;
+    sqe->len = 1;
+    sqe->user_data = URING_TAG_SEND;
+}
+
+/* Accounts for res bytes sent. Returns 1 once the whole batch went out. */
+static int uring_sent(struct uring_conn* uc, int sk, size_t res) {
+    struct msghdr* msg = &uc->sending->msg;
+    struct io_uring_sqe* sqe;
+
+    while (msg->msg_iovlen > 0 && res >= msg->msg_iov->iov_len) {
+        res -= msg->msg_iov->iov_len;
+        msg->msg_iov++;
+        msg->msg_iovlen--;
+    }
+    if (msg->msg_iovlen == 0)
+        return 1;
+
+    /* Short send, queue the remainder. */
+    msg->msg_iov->iov_base = (char*)msg->msg_iov->iov_base + res;
+    msg->msg_iov->iov_len -= res;
+    sqe = uring_get_sqe(&uc->ring);
+    assert(sqe);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sk;
+    sqe->addr = (unsigned long)msg;
+    sqe->len = 1;
+    sqe->user_data = URING_TAG_SEND;
+    return 0;
+}
+
+/* Serves every complete request in the staging buffer. Returns 1 on NBD_CMD_DISC. */
+static int uring_parse(struct buse_conn* conn, struct uring_conn* uc) {
+    const struct buse_operations* aop = conn->server->aop;
+    void* userdata = conn->server->userdata;
+    struct nbd_request request;
+    u_int64_t from;
+    u_int32_t len;
+    void* chunk;
+    int error;
+
+    while (uc->rx_end - uc->rx_start >= sizeof(request)) {
+        memcpy(&request, uc->rx + uc->rx_start, sizeof(request));
+        assert(request.magic == htonl(NBD_REQUEST_MAGIC));
+        len = ntohl(request.len);
+        from = ntohll(request.from);
+
+        switch (ntohl(request.type) & NBD_CMD_MASK) {
+            case NBD_CMD_READ:
+                uc->rx_start += sizeof(request);
+                if (aop->read_ref && !aop->read_end) {
+                    const void* data = NULL;
+                    error = aop->read_ref(&data, len, from, userdata);
+                    batch_add(uc->pending, request.handle, error, data, error ? 0 : len, 0);
+                    break;
+                }
+                chunk = bufpool_get(conn->pool, len);
+                assert(chunk);
+                error = aop->read ? aop->read(chunk, len, from, userdata) : EPERM;
+                batch_add(uc->pending, request.handle, error, chunk, error ? 0 : len, 1);
+                break;
+            case NBD_CMD_WRITE:
+                /* The payload is served straight from the staging buffer. */
+                if (uc->rx_end - uc->rx_start < sizeof(request) + len)
+                    return 0;
+                uc->rx_start += sizeof(request);
+                error = aop->write ? complete_fua(aop, &request, aop->write(uc->rx + uc->rx_start, len, from, userdata), userdata) : EPERM;
+                uc->rx_start += len;
+                batch_add(uc->pending, request.handle, error, NULL, 0, 0);
+                break;
+            case NBD_CMD_DISC:
+                uc->rx_start += sizeof(request);
+                return 1;
+#ifdef NBD_FLAG_SEND_FLUSH
+            case NBD_CMD_FLUSH:
+                uc->rx_start += sizeof(request);
+                error = aop->flush ? aop->flush(userdata) : 0;
+                batch_add(uc->pending, request.handle, error, NULL, 0, 0);
+                break;
+#endif
+#ifdef NBD_FLAG_SEND_TRIM
+            case NBD_CMD_TRIM:
+                uc->rx_start += sizeof(request);
+                error = aop->trim ? aop->trim(from, len, userdata) : 0;
+                batch_add(uc->pending, request.handle, error, NULL, 0, 0);
+                break;
+#endif
+            case NBD_CMD_WRITE_ZEROES:
+                uc->rx_start += sizeof(request);
+                error = aop->write_zeroes ? complete_fua(aop, &request, aop->write_zeroes(from, len, (ntohl(request.type) & NBD_CMD_FLAG_NO_HOLE) != 0, userdata), userdata) : EINVAL;
+                batch_add(uc->pending, request.handle, error, NULL, 0, 0);
+                break;
+            default:
+                warnx("unsupported NBD command %u", ntohl(request.type));
+                uc->rx_start += sizeof(request);
+                batch_add(uc->pending, request.handle, EINVAL, NULL, 0, 0);
+                break;
+        }
+    }
+    return 0;
+}
+
+/* Serve userland side of nbd socket with io_uring. Returns -1 if the ring
+ * could not be set up and nothing was read, so the caller can fall back. */
+static int serve_nbd_uring(struct buse_conn* conn) {
+    struct uring_conn uc;
+    struct io_uring_cqe* cqe;
+    int receiving = 1, disconnect = 0, status = EXIT_SUCCESS;
+    int err;
+
+    memset(&uc, 0, sizeof(uc));
+    err = uring_init(&uc.ring, URING_ENTRIES);
+    if (err < 0) {
+        warnx("io_uring setup failed: %s", strerror(-err));
+        return -1;
+    }
+    uc.rx_cap = URING_RX_SIZE;
+    uc.rx = malloc(uc.rx_cap);
+    assert(uc.rx);
+    uc.pending = &uc.batches[0];
+    uc.sending = NULL;
+
+    uring_queue_recv(&uc, conn->sk);
+    while (receiving || uc.sending) {
+        err = uring_submit_and_wait(&uc.ring, 1);
+        if (err < 0) {
+            warnx("io_uring_enter failed: %s", strerror(-err));
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        while ((cqe = uring_peek_cqe(&uc.ring)) != NULL) {
+            __u64 tag = cqe->user_data;
+            int res = cqe->res;
+            uring_cqe_seen(&uc.ring);
+
+            if (tag == URING_TAG_RECV) {
+                if (res <= 0) {
+                    if (res < 0) {
+                        warnx("error reading userside of nbd socket: %s", strerror(-res));
+                        status = EXIT_FAILURE;
+                    }
+                    receiving = 0;
+                    continue;
+                }
+                uc.rx_end += res;
+                disconnect = uring_parse(conn, &uc);
+                if (disconnect)
+                    receiving = 0;
+                else
+                    uring_queue_recv(&uc, conn->sk);
+            } else if (tag == URING_TAG_SEND) {
+                if (res < 0) {
+                    warnx("error writing userside of nbd socket: %s", strerror(-res));
+                    receiving = 0;
+                    status = EXIT_FAILURE;
+                    batch_release(conn->pool, uc.sending);
+                    uc.sending = NULL;
+                } else if (uring_sent(&uc, conn->sk, res)) {
+                    batch_release(conn->pool, uc.sending);
+                    uc.sending = NULL;
+                }
+            }
+        }
+
+        /* Replies wait while the previous batch is on the wire to keep them in order. */
+        if (!uc.sending && uc.pending->count > 0 && status == EXIT_SUCCESS)
+            uring_queue_send(&uc, conn->sk);
+    }
+
+    batch_release(conn->pool, &uc.batches[0]);
+    batch_release(conn->pool, &uc.batches[1]);
+    free(uc.batches[0].replies);
+    free(uc.batches[0].iov);
+    free(uc.batches[1].replies);
+    free(uc.batches[1].iov);
+    free(uc.rx);
+    uring_exit(&uc.ring);
+
+    if (disconnect)
+        handle_disconnect(conn->server);
+    return status;
+}
+#endif
+
+/* Serves one connection with the engine the operations ask for. */
+static int serve_conn(struct buse_conn* conn) {
+#ifdef BUSE_HAVE_IO_URING
+    if (conn->server->aop->engine == BUSE_ENGINE_URING) {
+        if (conn->server->aop->submit) {
+            warnx("io_uring engine does not support asynchronous submit, using blocking engine");
+        } else {
+            int status = serve_nbd_uring(conn);
+            if (status != -1)
+                return status;
+            warnx("falling back to blocking engine");
+        }
+    }
+#else
+    if (conn->server->aop->engine == BUSE_ENGINE_URING)
+        warnx("buse was built without io_uring support, using blocking engine");
+#endif
+    return serve_nbd(conn);
+}
+
+static void* serve_nbd_thread(void* arg) {
+    struct buse_conn* conn = arg;
+    conn->status = serve_conn(conn);
+    return NULL;
+}
+
+void buse_pool_counters(u_int64_t* hits, u_int64_t* misses) {
+    bufpool_counters(hits, misses);
+}
+
 int buse_main(const char* dev_file, const struct buse_operations* aop, void* userdata) {
+    struct buse_server server = {aop, userdata, PTHREAD_MUTEX_INITIALIZER, 0};
+    struct buse_conn* conns;
+    u_int32_t nconns = aop->connections ? aop->connections : 1;
+    u_int32_t i;
     int sp[2];
-    int nbd, sk, err, flags;
-
-    err = socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
-    assert(!err);
+    int nbd, err, flags;
+
+    conns = calloc(nconns, sizeof(*conns));
+    assert(conns);
+    for (i = 0; i < nconns; i++) {
+        err = socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+        assert(!err);
+        conns[i].server = &server;
+        conns[i].sk = sp[0];
+        conns[i].kernel_sk = sp[1];
+        pthread_mutex_init(&conns[i].lock, NULL);
+        pthread_cond_init(&conns[i].idle, NULL);
+        conns[i].pool = bufpool_create(aop->pool_buffers ? aop->pool_buffers : BUSE_POOL_BUFFERS,
+                                       aop->pool_buffer_size ? aop->pool_buffer_size : BUSE_POOL_BUFFER_SIZE,
+                                       aop->pool_hugepages);
+    }
 
     nbd = open(dev_file, O_RDWR);
     if (nbd == -1) {
@@ -259,34 +904,43 @@ int buse_main(const char* dev_file, const struct buse_operations* aop, void* use
             exit(EXIT_FAILURE);
         }
 
-        /* The child needs to continue setting things up. */
-        close(sp[0]);
-        sk = sp[1];
+        /* The child needs to continue setting things up. Every NBD_SET_SOCK
+         * adds one more connection to the device. */
+        for (i = 0; i < nconns; i++) {
+            close(conns[i].sk);
+            if (ioctl(nbd, NBD_SET_SOCK, conns[i].kernel_sk) == -1) {
+                fprintf(stderr, "ioctl(nbd, NBD_SET_SOCK, sk) failed.[%s]\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
 
-        if (ioctl(nbd, NBD_SET_SOCK, sk) == -1) {
-            fprintf(stderr, "ioctl(nbd, NBD_SET_SOCK, sk) failed.[%s]\n", strerror(errno));
-            exit(EXIT_FAILURE);
-        } else {
 #if defined NBD_SET_FLAGS
-            flags = 0;
+        flags = 0;
+#if defined NBD_FLAG_CAN_MULTI_CONN
+        if (nconns > 1)
+            flags |= NBD_FLAG_CAN_MULTI_CONN;
+#endif
 #if defined NBD_FLAG_SEND_TRIM
-            flags |= NBD_FLAG_SEND_TRIM;
+        flags |= NBD_FLAG_SEND_TRIM;
 #endif
 #if defined NBD_FLAG_SEND_FLUSH
-            flags |= NBD_FLAG_SEND_FLUSH;
+        flags |= NBD_FLAG_SEND_FLUSH;
 #endif
-            if (flags != 0 && ioctl(nbd, NBD_SET_FLAGS, flags) == -1) {
-                fprintf(stderr, "ioctl(nbd, NBD_SET_FLAGS, %d) failed.[%s]\n", flags, strerror(errno));
-                exit(EXIT_FAILURE);
-            }
+        if (aop->write_zeroes || aop->submit)
+            flags |= NBD_FLAG_SEND_WRITE_ZEROES;
+        if (aop->sync_range || aop->submit)
+            flags |= NBD_FLAG_SEND_FUA;
+        if (flags != 0 && ioctl(nbd, NBD_SET_FLAGS, flags) == -1) {
+            fprintf(stderr, "ioctl(nbd, NBD_SET_FLAGS, %d) failed.[%s]\n", flags, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
 #endif
-            err = ioctl(nbd, NBD_DO_IT);
-            if (BUSE_DEBUG)
-                fprintf(stderr, "nbd device terminated with code %d\n", err);
-            if (err == -1) {
-                warn("NBD_DO_IT terminated with error");
-                exit(EXIT_FAILURE);
-            }
+        err = ioctl(nbd, NBD_DO_IT);
+        if (BUSE_DEBUG)
+            fprintf(stderr, "nbd device terminated with code %d\n", err);
+        if (err == -1) {
+            warn("NBD_DO_IT terminated with error");
+            exit(EXIT_FAILURE);
         }
 
         if (ioctl(nbd, NBD_CLEAR_QUE) == -1 || ioctl(nbd, NBD_CLEAR_SOCK) == -1) {
@@ -313,16 +967,34 @@ int buse_main(const char* dev_file, const struct buse_operations* aop, void* use
         return EXIT_FAILURE;
     }
 
-    close(sp[1]);
+    for (i = 0; i < nconns; i++) {
+        close(conns[i].kernel_sk);
+    }
 
     if (aop->init)
         aop->init(userdata);
 
-    /* serve NBD socket */
-    int status;
-    status = serve_nbd(sp[0], aop, userdata);
-    if (close(sp[0]) != 0)
-        warn("problem closing server side nbd socket");
+    /* serve NBD sockets, the first one on the calling thread */
+    int status = 0;
+    for (i = 1; i < nconns; i++) {
+        if (pthread_create(&conns[i].thread, NULL, serve_nbd_thread, &conns[i]) != 0) {
+            errx(EXIT_FAILURE, "failed to start thread for nbd connection %u", i);
+        }
+    }
+    conns[0].status = serve_conn(&conns[0]);
+    for (i = 1; i < nconns; i++) {
+        pthread_join(conns[i].thread, NULL);
+    }
+    for (i = 0; i < nconns; i++) {
+        if (close(conns[i].sk) != 0)
+            warn("problem closing server side nbd socket");
+        if (conns[i].status != 0)
+            status = conns[i].status;
+        pthread_mutex_destroy(&conns[i].lock);
+        pthread_cond_destroy(&conns[i].idle);
+        bufpool_destroy(conns[i].pool);
+    }
+    free(conns);
     if (status != 0)
         return status;
 
@@ -7,6 +7,38 @@ extern "C" {
 
 #include <sys/types.h>
 
+struct buse_conn;
+
+enum buse_request_type {
+    BUSE_CMD_READ,
+    BUSE_CMD_WRITE,
+    BUSE_CMD_FLUSH,
+    BUSE_CMD_TRIM,
+    BUSE_CMD_WRITE_ZEROES,
+};
+
+// A request handed to the submit callback. The backend owns it until it passes it back to
+// buse_complete(), which may happen from any thread and in any order.
+struct buse_request {
+    enum buse_request_type type;
+    u_int64_t from;
+    u_int32_t len;
+    void* buf;  // destination for reads, payload for writes, NULL otherwise and for reads when read_ref is set
+    const void* data;  // reads may point this at the backend's storage instead of filling buf, and must when
+                       // read_ref is set; read_end is then called once it has been sent
+    int fua;           // writes and write zeroes must be durable before they are completed
+    int no_hole;       // write zeroes must leave the range allocated
+
+    // private to buse
+    struct buse_conn* conn;
+    char handle[8];
+};
+
+enum buse_engine {
+    BUSE_ENGINE_BLOCKING,  // one blocking read/write per header and payload
+    BUSE_ENGINE_URING,     // batched socket I/O through io_uring, falls back to blocking if unavailable
+};
+
 struct buse_operations {
     int (*read)(void* buf, u_int32_t len, u_int64_t offset, void* userdata);
     int (*write)(const void* buf, u_int32_t len, u_int64_t offset, void* userdata);
@@ -15,14 +47,62 @@ struct buse_operations {
     int (*trim)(u_int64_t from, u_int32_t len, void* userdata);
     int (*init)(void* userdata);
 
+    // optional, zeroes len bytes at from without a payload; the backend may deallocate the range unless no_hole
+    // is set, which the kernel does for zeroouts that must leave it provisioned. Write zeroes is only advertised
+    // to the kernel when this or submit is set
+    int (*write_zeroes)(u_int64_t from, u_int32_t len, int no_hole, void* userdata);
+
+    // optional, makes a written range durable; called after a write or write zeroes the kernel flagged FUA
+    // and before its reply. FUA is only advertised to the kernel when this or submit is set
+    int (*sync_range)(u_int64_t from, u_int32_t len, void* userdata);
+
+    // optional zero-copy read, points *data at len bytes of the backend's storage which must stay valid
+    // until the reply is sent; used instead of read when set
+    int (*read_ref)(const void** data, u_int32_t len, u_int64_t offset, void* userdata);
+    // optional, called on the same thread once the data of a successful read_ref has been sent or, where the
+    // socket cannot take it without blocking, copied aside, e.g. to drop a lock taken by read_ref, which is
+    // then never held while waiting on the peer; the io_uring engine sends replies later in batches, after it
+    // has moved on to later requests, so it copies every read through read instead of read_ref when read_end
+    // is set
+    void (*read_end)(u_int32_t len, u_int64_t offset, void* userdata);
+
+    // optional zero-copy write, used by the blocking engine instead of write when both are set: write_begin
+    // points *dest at len bytes of the backend's storage, the payload is received straight into it and
+    // write_end is called once it has landed; write_end is not called if write_begin fails. When write is set
+    // too, it is used instead unless the whole payload is already queued on the socket, so a lock taken in
+    // write_begin is never held while waiting on the network
+    int (*write_begin)(void** dest, u_int32_t len, u_int64_t offset, void* userdata);
+    int (*write_end)(u_int32_t len, u_int64_t offset, void* userdata);
+
+    // optional asynchronous entry point, replaces the callbacks above for reads, writes, flushes, trims and
+    // write zeroes
+    int (*submit)(struct buse_request* req, void* userdata);
+
     // either set size, OR set both blksize and size_blocks
     u_int64_t size;
     u_int32_t blksize;
     u_int64_t size_blocks;
+
+    // number of sockets handed to the kernel, each served by its own thread (0 means 1)
+    u_int32_t connections;
+
+    // socket I/O engine used to serve the connections
+    enum buse_engine engine;
+
+    // preallocated I/O buffers per connection and their size in bytes, 0 for the defaults
+    u_int32_t pool_buffers;
+    u_int32_t pool_buffer_size;
+    int pool_hugepages;  // back the pool with hugepages if possible
 };
 
 int buse_main(const char* dev_file, const struct buse_operations* bop, void* userdata);
 
+// Sends the reply for a request accepted by submit and releases it. error is 0 or an errno value.
+void buse_complete(struct buse_request* req, int error);
+
+// Number of request buffers served from the pools and allocated because a pool was exhausted or too small.
+void buse_pool_counters(u_int64_t* hits, u_int64_t* misses);
+
 #ifdef __cplusplus
 }
 #endif
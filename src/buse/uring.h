@@ -0,0 +1,49 @@
+#ifndef BUSE_URING_H_INCLUDED
+#define BUSE_URING_H_INCLUDED
+
+/*
+ * Minimal io_uring wrapper on top of the raw system calls, so that buse does
+ * not depend on liburing. Only what the socket event loop needs is provided.
+ */
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_pending;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+/* Returns 0 on success or a negative errno value. */
+int uring_init(struct uring* ring, unsigned entries);
+void uring_exit(struct uring* ring);
+
+/* Returns a zeroed submission entry, or NULL if the submission queue is full. */
+struct io_uring_sqe* uring_get_sqe(struct uring* ring);
+
+/* Submits every queued entry and waits for at least wait_nr completions. */
+int uring_submit_and_wait(struct uring* ring, unsigned wait_nr);
+
+/* Returns the next completion without waiting, or NULL if there is none. */
+struct io_uring_cqe* uring_peek_cqe(struct uring* ring);
+void uring_cqe_seen(struct uring* ring);
+
+#endif /* BUSE_URING_H_INCLUDED */
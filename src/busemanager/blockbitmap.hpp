@@ -0,0 +1,114 @@
+#ifndef BLOCK_BITMAP_H
+#define BLOCK_BITMAP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * @brief Fixed-size bitmap with one atomic bit per block.
+ *
+ * Bits may be set concurrently from any number of threads. drain() atomically takes ownership of every set bit
+ * and reports them as runs of consecutive blocks, so a bit set while a drain is in progress is either reported
+ * by that drain or left in place for the next one, never lost.
+ */
+class BlockBitmap {
+   public:
+    explicit BlockBitmap(uint64_t bits = 0) : bitCount(bits), wordCount((bits + 63) / 64) {
+        words = std::make_unique<std::atomic<uint64_t>[]>(wordCount);
+    }
+
+    uint64_t size() const { return bitCount; }
+
+    /**
+     * @brief Sets every bit in [first, first + count).
+     */
+    void set(uint64_t first, uint64_t count) {
+        forEachWord(first, count, [](std::atomic<uint64_t>& word, uint64_t mask) { word.fetch_or(mask, std::memory_order_release); });
+    }
+
+    /**
+     * @brief Clears every bit in [first, first + count).
+     */
+    void clear(uint64_t first, uint64_t count) {
+        forEachWord(first, count, [](std::atomic<uint64_t>& word, uint64_t mask) { word.fetch_and(~mask, std::memory_order_acq_rel); });
+    }
+
+    bool test(uint64_t bit) const { return (words[bit / 64].load(std::memory_order_acquire) >> (bit % 64)) & 1U; }
+
+    /**
+     * @brief Atomically clears the bitmap and invokes onRun(firstBit, bitCount) for every run of set bits.
+     *
+     * Runs are reported in ascending order and adjacent runs are merged across word boundaries.
+     */
+    template <typename Fn>
+    void drain(Fn&& onRun) {
+        drain(0, bitCount, std::forward<Fn>(onRun));
+    }
+
+    /**
+     * @brief Like drain(), but only takes the bits in [first, first + count).
+     *
+     * first must be a multiple of 64 and count either a multiple of 64 or reaching the end of the bitmap, so
+     * disjoint ranges can be drained concurrently from different threads.
+     */
+    template <typename Fn>
+    void drain(uint64_t first, uint64_t count, Fn&& onRun) {
+        uint64_t runStart = 0;
+        uint64_t runLength = 0;
+        uint64_t lastWord = std::min(wordCount, (first + count + 63) / 64);
+
+        for (uint64_t w = first / 64; w < lastWord; w++) {
+            uint64_t bits = words[w].load(std::memory_order_relaxed) != 0 ? words[w].exchange(0, std::memory_order_acq_rel) : 0;
+            if (bits == 0) {
+                if (runLength != 0) {
+                    onRun(runStart, runLength);
+                    runLength = 0;
+                }
+                continue;
+            }
+            if (bits == ~uint64_t{0}) {
+                if (runLength == 0)
+                    runStart = w * 64;
+                runLength += 64;
+                continue;
+            }
+
+            for (uint64_t b = 0; b < 64; b++) {
+                if ((bits >> b) & 1U) {
+                    if (runLength == 0)
+                        runStart = w * 64 + b;
+                    runLength++;
+                } else if (runLength != 0) {
+                    onRun(runStart, runLength);
+                    runLength = 0;
+                }
+            }
+        }
+
+        if (runLength != 0)
+            onRun(runStart, runLength);
+    }
+
+   private:
+    uint64_t bitCount;
+    uint64_t wordCount;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+    template <typename Op>
+    void forEachWord(uint64_t first, uint64_t count, Op&& op) {
+        uint64_t end = first + count;
+        while (first < end) {
+            uint64_t bit = first % 64;
+            uint64_t span = std::min<uint64_t>(64 - bit, end - first);
+            uint64_t mask = span == 64 ? ~uint64_t{0} : ((uint64_t{1} << span) - 1) << bit;
+            op(words[first / 64], mask);
+            first += span;
+        }
+    }
+};
+
+#endif  // BLOCK_BITMAP_H
@@ -0,0 +1,130 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOCK_COMPARE_X86
+#endif
+
+#include "blockcompare.hpp"
+
+namespace {
+
+using BlockEqualFn = bool (*)(const char* a, const char* b);
+
+// Every kernel compares one full COMPARE_BLOCK_SIZE block. They fold the XOR of the whole block into one
+// accumulator and test it once at the end, which keeps the inner loop free of branches; blocks are small
+// enough that an early exit on the first difference would not pay for the extra tests.
+
+bool blockEqualScalar(const char* a, const char* b) {
+    return std::memcmp(a, b, COMPARE_BLOCK_SIZE) == 0;
+}
+
+#ifdef BLOCK_COMPARE_X86
+
+__attribute__((target("sse2"))) bool blockEqualSse2(const char* a, const char* b) {
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    for (uint64_t i = 0; i < COMPARE_BLOCK_SIZE; i += 64) {
+        __m128i x0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m128i x1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 16)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 16)));
+        __m128i x2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 32)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 32)));
+        __m128i x3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 48)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 48)));
+        acc0 = _mm_or_si128(acc0, _mm_or_si128(x0, x1));
+        acc1 = _mm_or_si128(acc1, _mm_or_si128(x2, x3));
+    }
+    __m128i acc = _mm_or_si128(acc0, acc1);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xffff;
+}
+
+__attribute__((target("avx2"))) bool blockEqualAvx2(const char* a, const char* b) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    for (uint64_t i = 0; i < COMPARE_BLOCK_SIZE; i += 128) {
+        __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 32)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 32)));
+        __m256i x2 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 64)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 64)));
+        __m256i x3 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 96)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 96)));
+        acc0 = _mm256_or_si256(acc0, _mm256_or_si256(x0, x1));
+        acc1 = _mm256_or_si256(acc1, _mm256_or_si256(x2, x3));
+    }
+    __m256i acc = _mm256_or_si256(acc0, acc1);
+    return _mm256_testz_si256(acc, acc) != 0;
+}
+
+__attribute__((target("avx512f"))) bool blockEqualAvx512(const char* a, const char* b) {
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    for (uint64_t i = 0; i < COMPARE_BLOCK_SIZE; i += 256) {
+        __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        __m512i x1 = _mm512_xor_si512(_mm512_loadu_si512(a + i + 64), _mm512_loadu_si512(b + i + 64));
+        __m512i x2 = _mm512_xor_si512(_mm512_loadu_si512(a + i + 128), _mm512_loadu_si512(b + i + 128));
+        __m512i x3 = _mm512_xor_si512(_mm512_loadu_si512(a + i + 192), _mm512_loadu_si512(b + i + 192));
+        acc0 = _mm512_or_si512(acc0, _mm512_or_si512(x0, x1));
+        acc1 = _mm512_or_si512(acc1, _mm512_or_si512(x2, x3));
+    }
+    __m512i acc = _mm512_or_si512(acc0, acc1);
+    return _mm512_test_epi64_mask(acc, acc) == 0;
+}
+
+#endif  // BLOCK_COMPARE_X86
+
+struct Kernel {
+    BlockEqualFn blockEqual;
+    const char* name;
+};
+
+Kernel selectKernel() {
+#ifdef BLOCK_COMPARE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return {blockEqualAvx512, "avx512"};
+    if (__builtin_cpu_supports("avx2"))
+        return {blockEqualAvx2, "avx2"};
+    if (__builtin_cpu_supports("sse2"))
+        return {blockEqualSse2, "sse2"};
+#endif
+    return {blockEqualScalar, "scalar"};
+}
+
+const Kernel& kernel() {
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+}  // namespace
+
+uint64_t compareBlocks(const char* a, const char* b, uint64_t len, uint64_t* mask) {
+    BlockEqualFn blockEqual = kernel().blockEqual;
+    uint64_t fullBlocks = len / COMPARE_BLOCK_SIZE;
+    uint64_t tail = len % COMPARE_BLOCK_SIZE;
+    uint64_t differing = 0;
+
+    std::memset(mask, 0, (fullBlocks + 64) / 64 * sizeof(uint64_t));
+    for (uint64_t block = 0; block < fullBlocks; block++) {
+        uint64_t offset = block * COMPARE_BLOCK_SIZE;
+        if (!blockEqual(a + offset, b + offset)) {
+            mask[block / 64] |= uint64_t{1} << (block % 64);
+            differing++;
+        }
+    }
+    if (tail != 0) {
+        uint64_t offset = fullBlocks * COMPARE_BLOCK_SIZE;
+        if (std::memcmp(a + offset, b + offset, tail) != 0) {
+            mask[fullBlocks / 64] |= uint64_t{1} << (fullBlocks % 64);
+            differing++;
+        }
+    }
+    return differing;
+}
+
+const char* compareBlocksKernel() {
+    return kernel().name;
+}
@@ -0,0 +1,28 @@
+#ifndef BLOCK_COMPARE_H
+#define BLOCK_COMPARE_H
+
+#include <cstdint>
+
+constexpr uint64_t COMPARE_BLOCK_SIZE = 4096;
+
+/**
+ * @brief Compares two buffers in 4 KiB blocks and reports which blocks differ.
+ *
+ * Bit i of mask (mask[i / 64] >> i % 64) is set when block i differs and cleared otherwise, so mask must hold
+ * (len / COMPARE_BLOCK_SIZE + 64) / 64 words. A trailing partial block is compared as a short block. The kernel
+ * is picked once at runtime from the widest of AVX-512, AVX2 and SSE2 the CPU supports.
+ *
+ * @param a First buffer.
+ * @param b Second buffer.
+ * @param len Number of bytes to compare.
+ * @param mask Receives one bit per block.
+ * @return The number of differing blocks.
+ */
+uint64_t compareBlocks(const char* a, const char* b, uint64_t len, uint64_t* mask);
+
+/**
+ * @brief Returns the name of the kernel compareBlocks() dispatches to, e.g. "avx2".
+ */
+const char* compareBlocksKernel();
+
+#endif  // BLOCK_COMPARE_H
@@ -0,0 +1,80 @@
+#ifndef BLOCK_EPOCHS_H
+#define BLOCK_EPOCHS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * @brief Per-block generation numbers: the synchronization epoch in which each block was last modified.
+ *
+ * Epochs only grow. Stamps may be written concurrently from any number of threads; latest() tracks the highest
+ * epoch ever stamped, so "has anything been modified after epoch N" is a single load.
+ */
+class BlockEpochs {
+   public:
+    explicit BlockEpochs(uint64_t blocks = 0) : blockCount(blocks) {
+        epochs = std::make_unique<std::atomic<uint64_t>[]>(blocks);
+    }
+
+    // Moves are only meant for setting up an owner before any thread stamps blocks
+    BlockEpochs(BlockEpochs&& other) noexcept { *this = std::move(other); }
+    BlockEpochs& operator=(BlockEpochs&& other) noexcept {
+        blockCount = other.blockCount;
+        epochs = std::move(other.epochs);
+        latestEpoch.store(other.latestEpoch.load());
+        return *this;
+    }
+
+    uint64_t size() const { return blockCount; }
+
+    /**
+     * @brief Records that every block in [first, first + count) was modified in the given epoch.
+     */
+    void stamp(uint64_t first, uint64_t count, uint64_t epoch) {
+        for (uint64_t block = first; block < first + count; block++) {
+            epochs[block].store(epoch, std::memory_order_relaxed);
+        }
+        uint64_t seen = latestEpoch.load(std::memory_order_relaxed);
+        while (seen < epoch && !latestEpoch.compare_exchange_weak(seen, epoch, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t get(uint64_t block) const { return epochs[block].load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the highest epoch ever stamped, 0 if nothing was.
+     */
+    uint64_t latest() const { return latestEpoch.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Invokes onRun(firstBlock, blockCount) for every run of blocks stamped with an epoch after since.
+     *
+     * Runs are reported in ascending order.
+     */
+    template <typename Fn>
+    void forEachChangedRun(uint64_t since, Fn&& onRun) const {
+        uint64_t runStart = 0;
+        uint64_t runLength = 0;
+        for (uint64_t block = 0; block < blockCount; block++) {
+            if (get(block) > since) {
+                if (runLength == 0)
+                    runStart = block;
+                runLength++;
+            } else if (runLength != 0) {
+                onRun(runStart, runLength);
+                runLength = 0;
+            }
+        }
+        if (runLength != 0)
+            onRun(runStart, runLength);
+    }
+
+   private:
+    uint64_t blockCount;
+    std::unique_ptr<std::atomic<uint64_t>[]> epochs;
+    std::atomic<uint64_t> latestEpoch{0};
+};
+
+#endif  // BLOCK_EPOCHS_H
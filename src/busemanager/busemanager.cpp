@@ -1,24 +1,111 @@
 #include <sys/types.h>
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <future>
 #include <loguru.hpp>
+#include <system_error>
+#include <thread>
+#include <utility>
 
+#include "blockcompare.hpp"
 #include "busemanager.hpp"
+#include "crc32c.hpp"
+#include "memoryremotestore.hpp"
+#include "remoteprotocol.hpp"
+#include "tcpremotestore.hpp"
 
-std::unique_ptr<char[]> BuseManager::buffer;
-std::unique_ptr<char[]> BuseManager::remoteBuffer;
-std::mutex BuseManager::writeMutex;
+MappedBuffer BuseManager::buffer;
+StripedLock BuseManager::rangeLocks;
 
-BuseManager::BuseManager(uint64_t bufferSize) : BUFFER_SIZE(bufferSize) {
+BuseManager::BuseManager(uint64_t bufferSize, const std::string& imagePath, const std::string& remoteEndpoint, bool hydrate,
+                         bool overwriteRemote)
+    : remoteEndpoint(remoteEndpoint) {
+    // A TCP remote is opened first, as a hydrated buffer may take its size from it
     try {
-        buffer = std::make_unique<char[]>(BUFFER_SIZE);
-        remoteBuffer = std::make_unique<char[]>(BUFFER_SIZE);
-    } catch (const std::bad_alloc& e) {
+        if (!remoteEndpoint.empty()) {
+            remote = std::make_unique<TcpRemoteStore>(remoteEndpoint);
+            rangeRemote = std::make_unique<TcpRemoteStore>(remoteEndpoint);
+            LOG_F(INFO, "Connected to remote %s with size %lu", remoteEndpoint.c_str(), remote->size());
+        }
+    } catch (const std::system_error& e) {
+        LOG_F(ERROR, "Failed to open remote store: %s", e.what());
+        throw;
+    }
+    if (hydrate && bufferSize == 0 && remote)
+        bufferSize = remote->size();
+
+    try {
+        buffer = imagePath.empty() ? MappedBuffer::anonymous(bufferSize) : MappedBuffer::file(imagePath, bufferSize);
+        BUFFER_SIZE = buffer.size();
+        if (!remote)
+            remote = std::make_unique<MemoryRemoteStore>(MappedBuffer::anonymous(BUFFER_SIZE));
+    } catch (const std::system_error& e) {
         LOG_F(ERROR, "Failed to allocate buffer: %s", e.what());
         throw;
     }
+    if (remote->size() < BUFFER_SIZE) {
+        LOG_F(ERROR, "Remote store is smaller than the buffer - %lu, %lu", remote->size(), BUFFER_SIZE);
+        throw std::system_error(ENOSPC, std::generic_category(), "remote store too small");
+    }
+    dirtyBlocks = BlockBitmap((BUFFER_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    syncingBlocks = BlockBitmap(dirtyBlocks.size());
+    roundBlocks = BlockBitmap(dirtyBlocks.size());
+    pushingBlocks = BlockBitmap(dirtyBlocks.size());
+    zeroBlocks = BlockBitmap(dirtyBlocks.size());
+    blockEpochs = BlockEpochs(dirtyBlocks.size());
+    syncedTree = HashTree(BUFFER_SIZE);  // An in-memory remote starts out zeroed, a TCP one is seeded below
+    uncheckedBlocks = BlockBitmap(dirtyBlocks.size());
+    missingBlocks = BlockBitmap(dirtyBlocks.size());
+    setScanThreads(0);
+
+    if (hydrate) {
+        try {
+            if (buffer.isFileBacked())
+                buffer.discard(0, BUFFER_SIZE);  // The remote store replaces whatever the image held
+            seedFromRemote(true, false);
+            if (missingCount.load() != 0 && !remoteEndpoint.empty())
+                faultRemote = std::make_unique<TcpRemoteStore>(remoteEndpoint);
+        } catch (const std::system_error& e) {
+            LOG_F(ERROR, "Failed to prepare hydration: %s", e.what());
+            throw;
+        }
+        LOG_F(INFO, "Hydrating from the remote store, %lu of %lu blocks hold data", missingCount.load(), dirtyBlocks.size());
+    } else if (buffer.isFileBacked()) {
+        // Checksumming the data here would read the whole image, so it is left to the first check of each block
+        uint64_t dataBytes = 0;
+        for (const auto& [offset, len] : buffer.dataExtents()) {
+            uint64_t firstBlock = offset / BLOCK_SIZE;
+            uint64_t blockCount = (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE - firstBlock;
+            markDirtyBlocks(firstBlock, blockCount);
+            uncheckedBlocks.set(firstBlock, blockCount);
+            dataBytes += len;
+        }
+        if (dataBytes != 0)
+            hasWrites.store(true);
+        LOG_F(INFO, "Image %s mapped, %lu bytes of existing data", imagePath.c_str(), dataBytes);
+    }
+    if (!hydrate && !remoteEndpoint.empty()) {
+        // Without its hashes the first check would take every block the remote holds for one this process lost
+        uint64_t conflicting;
+        try {
+            conflicting = seedFromRemote(false, overwriteRemote);
+        } catch (const std::system_error& e) {
+            LOG_F(ERROR, "Failed to fetch the remote block hashes: %s", e.what());
+            throw;
+        }
+        if (conflicting != 0 && !overwriteRemote) {
+            LOG_F(ERROR, "The remote store holds %lu blocks that differ from the buffer; hydrate from it or allow overwriting it",
+                  conflicting);
+            throw std::system_error(EEXIST, std::generic_category(), "remote store holds other data");
+        }
+        if (conflicting != 0) {
+            hasWrites.store(true);
+            LOG_F(WARNING, "Overwriting %lu blocks the remote store holds", conflicting);
+        }
+    }
     LOG_F(INFO, "Buffer allocated with size %lu", BUFFER_SIZE);
 }
 
@@ -26,83 +113,957 @@ BuseManager::~BuseManager() {
     if (isRunning.load()) {
         stopSyncThread();
     }
+    readaheadPool.reset();
+    for (auto& thread : hydrationThreads) {
+        thread.join();
+    }
+}
+
+uint64_t BuseManager::seedFromRemote(bool hydrate, bool overwrite) {
+    constexpr uint64_t SEED_CHUNK = 64 * 1024;  // Block hashes fetched per request
+    std::vector<uint64_t> hashes(SEED_CHUNK);
+    // A short last block is a full one on a larger remote store, so its hash tells nothing
+    uint64_t comparedBlocks = BUFFER_SIZE % BLOCK_SIZE != 0 && remote->size() > BUFFER_SIZE ? dirtyBlocks.size() - 1 : dirtyBlocks.size();
+    uint64_t found = 0;
+    for (uint64_t first = 0; first < dirtyBlocks.size(); first += SEED_CHUNK) {
+        uint64_t count = std::min(SEED_CHUNK, dirtyBlocks.size() - first);
+        remote->hashes(0, first, count, hashes.data());
+        syncedTree.setHashes(first, hashes.data(), count);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t block = first + i;
+            if (hashes[i] == syncedTree.zeroHash(block))
+                continue;
+            if (hydrate) {
+                missingBlocks.set(block, 1);
+                found++;
+            } else if (block < comparedBlocks &&
+                       (!buffer.isFileBacked() || hashBytes(buffer.get() + block * BLOCK_SIZE, blockLength(block)) != hashes[i])) {
+                if (overwrite)
+                    markDirtyBlocks(block, 1);
+                found++;
+            }
+        }
+    }
+    if (hydrate)
+        missingCount.store(found);
+    return found;
+}
+
+bool BuseManager::hydrate(uint64_t offset, uint64_t len) {
+    return hydrate(faultRemote ? *faultRemote : *remote, offset, len);
+}
+
+bool BuseManager::hydrate(RemoteStore& store, uint64_t offset, uint64_t len) {
+    if (len == 0 || missingCount.load() == 0)
+        return true;
+    uint64_t endBlock = (offset + len - 1) / BLOCK_SIZE + 1;
+    std::vector<char> scratch;
+    try {
+        for (uint64_t block = offset / BLOCK_SIZE; block < endBlock; block += HYDRATE_CHUNK_SIZE / BLOCK_SIZE) {
+            fetchMissing(store, block, std::min(block + HYDRATE_CHUNK_SIZE / BLOCK_SIZE, endBlock), scratch);
+        }
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Fetching %lu, %lu from the remote store failed: %s", offset, len, e.what());
+        return false;
+    }
+    return true;
+}
+
+bool BuseManager::hydrateEdges(uint64_t offset, uint64_t len) {
+    if (len == 0 || missingCount.load() == 0)
+        return true;
+    uint64_t end = offset + len;
+    if (offset % BLOCK_SIZE != 0 && !hydrate(offset, 1))
+        return false;
+    return end % BLOCK_SIZE == 0 || end == BUFFER_SIZE || hydrate(end - 1, 1);
+}
+
+void BuseManager::fetchMissing(RemoteStore& store, uint64_t firstBlock, uint64_t endBlock, std::vector<char>& scratch) {
+    while (firstBlock < endBlock && !missingBlocks.test(firstBlock)) {
+        firstBlock++;
+    }
+    while (endBlock > firstBlock && !missingBlocks.test(endBlock - 1)) {
+        endBlock--;
+    }
+    if (firstBlock == endBlock)
+        return;
+
+    // Fetched unlocked, so I/O on the range does not wait for the round trip
+    uint64_t start = firstBlock * BLOCK_SIZE;
+    uint64_t len = std::min(endBlock * BLOCK_SIZE, BUFFER_SIZE) - start;
+    scratch.resize(len);
+    store.get(start, scratch.data(), static_cast<uint32_t>(len));
+
+    RangeGuard lock(rangeLocks, start, len, true);
+    for (uint64_t block = firstBlock; block < endBlock; block++) {
+        if (!missingBlocks.test(block))
+            continue;  // Fetched by someone else, or written or trimmed since
+        const char* data = scratch.data() + (block - firstBlock) * BLOCK_SIZE;
+        std::memcpy(buffer.get() + block * BLOCK_SIZE, data, blockLength(block));
+        if (blockChecksums)
+            blockChecksums[block].store(crc32c(data, blockLength(block)), std::memory_order_relaxed);
+        missingBlocks.clear(block, 1);
+        missingCount.fetch_sub(1);
+    }
+}
+
+void BuseManager::settleMissing(uint64_t firstBlock, uint64_t blockCount) {
+    if (missingCount.load() == 0)
+        return;
+    for (uint64_t block = firstBlock; block < firstBlock + blockCount; block++) {
+        if (missingBlocks.test(block)) {
+            missingBlocks.clear(block, 1);
+            missingCount.fetch_sub(1);
+        }
+    }
+}
+
+void BuseManager::startHydration(size_t threads) {
+    if (missingCount.load() == 0)
+        return;
+    if (threads == 0)
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    LOG_F(INFO, "Hydrating %lu blocks in the background on %zu threads", missingCount.load(), threads);
+    runningHydrationThreads.store(threads);
+    for (size_t i = 0; i < threads; i++) {
+        hydrationThreads.emplace_back(&BuseManager::runHydration, this);
+    }
+}
+
+void BuseManager::setReadahead(uint64_t maxWindow) {
+    if (maxWindow == 0) {
+        readahead.reset();
+        return;
+    }
+    readahead = std::make_unique<SequentialDetector>(std::min(READAHEAD_MIN_WINDOW, maxWindow), maxWindow);
+    if (!readaheadPool)
+        readaheadPool = std::make_unique<ThreadPool>(READAHEAD_THREADS);
+    try {
+        if (!readaheadRemote && missingCount.load() != 0 && !remoteEndpoint.empty())
+            readaheadRemote = std::make_unique<TcpRemoteStore>(remoteEndpoint);
+    } catch (const std::system_error& e) {
+        LOG_F(ERROR, "Readahead will share the fault connection, opening its own failed: %s", e.what());
+    }
+}
+
+void BuseManager::noteRead(uint64_t offset, uint64_t len) {
+    if (!readahead || (missingCount.load() == 0 && !buffer.isFileBacked()))
+        return;
+    ReadaheadRange range = readahead->access(offset, len);
+    if (range.len == 0 || range.offset >= BUFFER_SIZE)
+        return;
+    range.len = std::min(range.len, BUFFER_SIZE - range.offset);
+
+    // A stream that outruns the readahead threads simply faults in what they did not get to
+    if (readaheadQueued.fetch_add(1) >= READAHEAD_QUEUE_DEPTH) {
+        readaheadQueued--;
+        return;
+    }
+    readaheadPool->submit([this, range] {
+        if (isRunning.load()) {
+            RemoteStore& store = readaheadRemote ? *readaheadRemote : faultRemote ? *faultRemote : *remote;
+            if (hydrate(store, range.offset, range.len) && buffer.isFileBacked())
+                buffer.prefetch(range.offset, range.len);
+        }
+        readaheadQueued--;
+    });
+}
+
+void BuseManager::runHydration() {
+    constexpr uint64_t CHUNK_BLOCKS = HYDRATE_CHUNK_SIZE / BLOCK_SIZE;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        // A connection of its own, so the threads fetch in parallel instead of taking turns on one socket
+        std::unique_ptr<RemoteStore> connection;
+        if (!remoteEndpoint.empty())
+            connection = std::make_unique<TcpRemoteStore>(remoteEndpoint);
+        RemoteStore& store = connection ? *connection : *remote;
+
+        std::vector<char> scratch;
+        uint64_t chunks = (dirtyBlocks.size() + CHUNK_BLOCKS - 1) / CHUNK_BLOCKS;
+        for (uint64_t chunk = nextHydrationChunk++; chunk < chunks && isRunning.load() && missingCount.load() != 0;
+             chunk = nextHydrationChunk++) {
+            fetchMissing(store, chunk * CHUNK_BLOCKS, std::min((chunk + 1) * CHUNK_BLOCKS, dirtyBlocks.size()), scratch);
+        }
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Background hydration failed, missing blocks are still fetched on access: %s", e.what());
+    }
+
+    if (--runningHydrationThreads == 0) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (missingCount.load() == 0)
+            LOG_F(INFO, "Hydration complete in %.1f s", seconds);
+        else
+            LOG_F(INFO, "Background hydration stopped after %.1f s with %lu blocks missing", seconds, missingCount.load());
+    }
 }
 
 void BuseManager::runPeriodicSync() {
     std::unique_lock<std::mutex> lock(lockMutex);
+    syncThreadRunning = true;
     while (isRunning.load()) {
-        if (intervalCV.wait_for(lock, std::chrono::seconds(SYNC_INTERVAL)) == std::cv_status::timeout && hasWrites.load()) {
-            LOG_F(INFO, "Syncing data");
-            synchronizeData();
+        bool woken = intervalCV.wait_for(lock, std::chrono::seconds(SYNC_INTERVAL), [this] { return flushRequested || !isRunning.load(); });
+        if (!isRunning.load())
+            break;
+        bool flushing = std::exchange(flushRequested, false);
+        // Modifications made durable only by syncRange() or left by a failed round still need a round to settle
+        if ((!woken && (hasWrites.exchange(false) || !isDurable())) || flushing) {
             hasWrites.store(false);
+            LOG_F(INFO, flushing ? "Syncing data for flush" : "Syncing data");
+            lock.unlock();
+            synchronizeData();
+            lock.lock();
         }
     }
+    lock.unlock();
     synchronizeData();
+
+    // A flush that saw the thread running after the final round was taken still needs a round of its own
+    lock.lock();
+    syncThreadRunning = false;
+    lock.unlock();
+    while (hasFlushWaiters()) {
+        synchronizeData();
+    }
     LOG_F(INFO, "Sync thread stopped");
 }
 
 void BuseManager::stopSyncThread() {
-    isRunning.store(false);
+    {
+        std::lock_guard<std::mutex> lock(lockMutex);
+        isRunning.store(false);
+    }
     intervalCV.notify_all();
     hasWrites.store(true);  // Ensure that the final sync is performed
 }
 
-void BuseManager::addWriteOperation(uint64_t startOffset, uint64_t endOffset) {
-    uint64_t length = endOffset - startOffset + 1;
-    if (length > MAX_WRITE_LENGTH) {
-        LOG_F(ERROR, "Length is too large. startOffset: %lu, endOffset: %lu", startOffset, endOffset);
-        for (uint64_t offset = startOffset; offset < endOffset; offset += MAX_WRITE_LENGTH) {
-            writeOps.emplace_back(WriteOp{offset, static_cast<uint32_t>(std::min(MAX_WRITE_LENGTH, endOffset - offset + 1))});
+bool BuseManager::flush() {
+    std::promise<bool> done;
+    std::future<bool> result = done.get_future();
+    flushAsync([&done](bool durable) { done.set_value(durable); });
+    return result.get();
+}
+
+void BuseManager::flushAsync(std::function<void(bool)> done) {
+    if (isDurable()) {
+        done(true);  // Nothing modified since the last durable round
+        return;
+    }
+    {
+        // Every write acknowledged before this point is dirty by now, so the next round to start covers it
+        std::lock_guard<std::mutex> lock(epochMutex);
+        flushWaiters.emplace_back(startedEpoch + 1, std::move(done));
+    }
+    {
+        std::lock_guard<std::mutex> lock(lockMutex);
+        if (syncThreadRunning) {
+            flushRequested = true;
+            intervalCV.notify_all();
+            return;
         }
-    } else {
-        writeOps.emplace_back(WriteOp{startOffset, static_cast<uint32_t>(length)});
     }
+    // A round that finds the remote missing data defers the flush to the next one
+    do {
+        synchronizeData();
+    } while (hasFlushWaiters());
+}
+
+bool BuseManager::hasFlushWaiters() {
+    std::lock_guard<std::mutex> lock(epochMutex);
+    return !flushWaiters.empty();
 }
 
-std::pair<uint64_t, uint64_t> BuseManager::findNextDifference(uint64_t startOffset) {
-    auto firstDiff = std::mismatch(buffer.get() + startOffset, buffer.get() + BUFFER_SIZE, remoteBuffer.get() + startOffset);
-    if (firstDiff.first == buffer.get() + BUFFER_SIZE) {
-        return {BUFFER_SIZE, BUFFER_SIZE};  // Indicate no more differences
+void BuseManager::completeEpoch(uint64_t epoch, bool durable) {
+    std::vector<std::function<void(bool)>> completed;
+    {
+        std::lock_guard<std::mutex> lock(epochMutex);
+        if (durable)
+            durableEpoch.store(epoch);
+        auto waiting = std::partition(flushWaiters.begin(), flushWaiters.end(), [epoch](const auto& waiter) { return waiter.first > epoch; });
+        for (auto it = waiting; it != flushWaiters.end(); ++it) {
+            completed.push_back(std::move(it->second));
+        }
+        flushWaiters.erase(waiting, flushWaiters.end());
+    }
+    for (auto& done : completed) {
+        done(durable);
     }
+    if (durable && journal)
+        retireJournal(epoch);
+}
 
-    uint64_t diffStart = firstDiff.first - buffer.get();
-    uint64_t diffEnd = diffStart;
-    for (uint64_t i = diffStart; i < BUFFER_SIZE && i - diffStart < MAX_WRITE_LENGTH; i++) {
-        if (buffer[i] != remoteBuffer[i]) {
-            diffEnd = i;
+void BuseManager::retireJournal(uint64_t epoch) {
+    if (!journal->canRetire(epoch))
+        return;
+    try {
+        buffer.sync();
+    } catch (const std::system_error& e) {
+        LOG_F(ERROR, "Keeping journal segments, syncing the image failed: %s", e.what());
+        return;
+    }
+    journal->retire(epoch);
+}
+
+void BuseManager::openJournal(const std::string& dir, bool syncWrites) {
+    auto opened = std::make_unique<Journal>(dir);
+    uint64_t skipped = 0;
+    uint64_t records = opened->replay(
+        [this, &skipped](Journal::RecordType type, uint64_t offset, const char* data, uint64_t len) {
+            if (len == 0 || offset > BUFFER_SIZE || len > BUFFER_SIZE - offset) {
+                skipped++;  // Journaled for a larger device
+                return;
+            }
+            if (type == Journal::RecordType::Trim || type == Journal::RecordType::Zero) {
+                RangeGuard lock(rangeLocks, offset, len, true);
+                clearBlocks(offset, len, type == Journal::RecordType::Trim);
+                return;
+            }
+            if (!hydrateEdges(offset, len))
+                throw std::system_error(EIO, std::generic_category(), "hydrate journaled range");
+            RangeGuard lock(rangeLocks, offset, len, true);
+            prepareWrite(offset, len);
+            std::memcpy(buffer.get() + offset, data, len);
+            markDirty(offset, len);
+        },
+        writeEpoch.load());
+    if (skipped != 0)
+        LOG_F(WARNING, "Skipped %lu journal records beyond the end of the device", skipped);
+    if (records != 0)
+        hasWrites.store(true);
+    LOG_F(INFO, "Journal %s opened, %lu records replayed", dir.c_str(), records);
+    journalSyncWrites = syncWrites;
+    journal = std::move(opened);  // Only now, so replayed modifications are not journaled again
+}
+
+bool BuseManager::commitWrite() {
+    if (!journal || (!journalSyncWrites && journal->pendingBytes() < JOURNAL_MAX_PENDING))
+        return true;
+    return journal->commit();
+}
+
+bool BuseManager::commitJournal() {
+    return !journal || journal->commit();
+}
+
+void BuseManager::markDirty(uint64_t offset, uint64_t len) {
+    if (len == 0)
+        return;
+    uint64_t firstBlock = offset / BLOCK_SIZE;
+    uint64_t lastBlock = (offset + len - 1) / BLOCK_SIZE;
+    for (uint64_t block = firstBlock; blockChecksums && block <= lastBlock; block++) {
+        blockChecksums[block].store(crc32c(buffer.get() + block * BLOCK_SIZE, blockLength(block)), std::memory_order_relaxed);
+    }
+    uncheckedBlocks.clear(firstBlock, lastBlock - firstBlock + 1);
+    settleMissing(firstBlock, lastBlock - firstBlock + 1);
+    markDirtyBlocks(firstBlock, lastBlock - firstBlock + 1);
+    if (journal)
+        journal->append(Journal::RecordType::Write, offset, buffer.get() + offset, len, writeEpoch.load());
+}
+
+void BuseManager::markDirtyBlocks(uint64_t firstBlock, uint64_t blockCount) {
+    // Stamped before the bit is visible, under the range lock that also orders it against the round's snapshot
+    blockEpochs.stamp(firstBlock, blockCount, writeEpoch.load());
+    dirtyBlocks.set(firstBlock, blockCount);
+}
+
+void BuseManager::enableChecksums() {
+    blockChecksums = std::make_unique<std::atomic<uint32_t>[]>(dirtyBlocks.size());
+    for (uint64_t block = 0; block < dirtyBlocks.size(); block++) {
+        blockChecksums[block].store(zeroChecksum(block), std::memory_order_relaxed);
+    }
+}
+
+bool BuseManager::verifyChecksums(uint64_t offset, uint64_t len) {
+    if (len == 0 || !blockChecksums)
+        return true;
+    bool intact = true;
+    uint64_t lastBlock = (offset + len - 1) / BLOCK_SIZE;
+    for (uint64_t block = offset / BLOCK_SIZE; block <= lastBlock; block++) {
+        uint32_t crc = crc32c(buffer.get() + block * BLOCK_SIZE, blockLength(block));
+        if (uncheckedBlocks.test(block)) {
+            // Concurrent readers of the block compute the same value, and writers are excluded by the range lock
+            blockChecksums[block].store(crc, std::memory_order_relaxed);
+            uncheckedBlocks.clear(block, 1);
+        } else if (crc != blockChecksums[block].load(std::memory_order_relaxed)) {
+            LOG_F(ERROR, "Checksum mismatch in block %lu: %08x, expected %08x", block, crc, blockChecksums[block].load(std::memory_order_relaxed));
+            intact = false;
         }
     }
+    return intact;
+}
+
+uint32_t BuseManager::zeroChecksum(uint64_t block) const {
+    static const uint32_t fullBlock = [] {
+        std::vector<char> zeros(BLOCK_SIZE);
+        return crc32c(zeros.data(), zeros.size());
+    }();
+    if (blockLength(block) == BLOCK_SIZE)
+        return fullBlock;
+    std::vector<char> zeros(blockLength(block));
+    return crc32c(zeros.data(), zeros.size());
+}
 
-    if (diffEnd - diffStart >= MAX_WRITE_LENGTH) {
-        LOG_F(ERROR, "Difference too large - %lu, %lu", diffStart, diffEnd);
+void BuseManager::markZero(uint64_t firstBlock, uint64_t blockCount) {
+    blockEpochs.stamp(firstBlock, blockCount, writeEpoch.load());
+    zeroBlocks.set(firstBlock, blockCount);
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> BuseManager::changedSince(uint64_t epoch) const {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    blockEpochs.forEachChangedRun(epoch, [this, &ranges](uint64_t firstBlock, uint64_t blockCount) {
+        uint64_t start = firstBlock * BLOCK_SIZE;
+        ranges.emplace_back(start, std::min((firstBlock + blockCount) * BLOCK_SIZE, BUFFER_SIZE) - start);
+    });
+    return ranges;
+}
+
+bool BuseManager::isDurable() const {
+    return blockEpochs.latest() <= durableEpoch.load();
+}
+
+bool BuseManager::isDurable(uint64_t offset, uint64_t len) const {
+    if (len == 0)
+        return true;
+    uint64_t durable = durableEpoch.load();
+    uint64_t lastBlock = (offset + len - 1) / BLOCK_SIZE;
+    for (uint64_t block = offset / BLOCK_SIZE; block <= lastBlock; block++) {
+        if (blockEpochs.get(block) > durable)
+            return false;
     }
+    return true;
+}
 
-    return {diffStart, diffEnd};
+uint64_t BuseManager::getStartedEpoch() {
+    std::lock_guard<std::mutex> lock(epochMutex);
+    return startedEpoch;
+}
+
+uint64_t BuseManager::getDurableEpoch() {
+    return durableEpoch.load();
+}
+
+void BuseManager::prepareWrite(uint64_t offset, uint64_t len) {
+    if (len == 0)
+        return;
+    uint64_t lastBlock = (offset + len - 1) / BLOCK_SIZE;
+    for (uint64_t block = offset / BLOCK_SIZE; block <= lastBlock; block++) {
+        if (!syncingBlocks.test(block))
+            continue;  // Common case: not part of a running round, or already staged
+
+        std::lock_guard<std::mutex> lock(cowMutex);
+        if (!syncingBlocks.test(block) || cowBlocks.count(block) != 0)
+            continue;
+        std::unique_ptr<char[]> copy(new char[blockLength(block)]);
+        std::memcpy(copy.get(), buffer.get() + block * BLOCK_SIZE, blockLength(block));
+        cowBlocks.emplace(block, std::move(copy));
+    }
+}
+
+void BuseManager::trim(uint64_t offset, uint64_t len) {
+    clearBlocks(offset, len, true);
+}
+
+void BuseManager::clearBlocks(uint64_t offset, uint64_t len, bool deallocate) {
+    uint64_t firstBlock = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint64_t endBlock = offset + len == BUFFER_SIZE ? dirtyBlocks.size() : (offset + len) / BLOCK_SIZE;
+    if (firstBlock >= endBlock)
+        return;
+
+    uint64_t start = firstBlock * BLOCK_SIZE;
+    uint64_t end = std::min(endBlock * BLOCK_SIZE, BUFFER_SIZE);
+    prepareWrite(start, end - start);
+    if (deallocate)
+        buffer.discard(start, end - start);
+    else
+        std::memset(buffer.get() + start, 0, end - start);
+    for (uint64_t block = firstBlock; blockChecksums && block < endBlock; block++) {
+        blockChecksums[block].store(zeroChecksum(block), std::memory_order_relaxed);
+    }
+    uncheckedBlocks.clear(firstBlock, endBlock - firstBlock);
+    settleMissing(firstBlock, endBlock - firstBlock);
+    dirtyBlocks.clear(firstBlock, endBlock - firstBlock);
+    markZero(firstBlock, endBlock - firstBlock);
+    if (journal)
+        journal->append(deallocate ? Journal::RecordType::Trim : Journal::RecordType::Zero, start, nullptr, end - start, writeEpoch.load());
+}
+
+void BuseManager::zeroRange(uint64_t offset, uint64_t len, bool keepAllocated) {
+    uint64_t end = offset + len;
+    uint64_t wholeStart = std::min((offset + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE, end);
+    uint64_t wholeEnd = end == BUFFER_SIZE ? end : std::max(end / BLOCK_SIZE * BLOCK_SIZE, wholeStart);
+
+    for (const auto& [start, stop] : {std::make_pair(offset, wholeStart), std::make_pair(wholeEnd, end)}) {
+        if (start == stop)
+            continue;
+        prepareWrite(start, stop - start);
+        std::memset(buffer.get() + start, 0, stop - start);
+        markDirty(start, stop - start);
+    }
+    clearBlocks(wholeStart, wholeEnd - wholeStart, !keepAllocated);
+}
+
+void BuseManager::stageRange(const WriteOp& op, char* dest) {
+    uint64_t firstBlock = op.offset / BLOCK_SIZE;
+    uint64_t lastBlock = (op.offset + op.len - 1) / BLOCK_SIZE;
+    for (uint64_t block = firstBlock; block <= lastBlock; block++) {
+        char* out = dest + (block - firstBlock) * BLOCK_SIZE;
+        auto cow = cowBlocks.find(block);
+        if (cow != cowBlocks.end()) {
+            std::memcpy(out, cow->second.get(), blockLength(block));
+            cowBlocks.erase(cow);
+        } else {
+            std::memcpy(out, buffer.get() + block * BLOCK_SIZE, blockLength(block));
+        }
+    }
+    syncingBlocks.clear(firstBlock, lastBlock - firstBlock + 1);
+}
+
+void BuseManager::addWriteOperation(uint64_t startOffset, uint64_t endOffset) {
+    for (uint64_t offset = startOffset; offset <= endOffset; offset += maxTransfer) {
+        writeOps.emplace_back(WriteOp{offset, static_cast<uint32_t>(std::min<uint64_t>(maxTransfer, endOffset - offset + 1))});
+    }
 }
 
 void BuseManager::consolidateWriteOperations() {
-    uint64_t startOffset = 0;
-    while (startOffset < BUFFER_SIZE) {
-        auto [diffStart, diffEnd] = findNextDifference(startOffset);
-        if (diffStart >= BUFFER_SIZE)
-            break;  // No more differing bytes
+    auto addRun = [this](uint64_t firstBlock, uint64_t blockCount) {
+        uint64_t startOffset = firstBlock * BLOCK_SIZE;
+        uint64_t endOffset = std::min((firstBlock + blockCount) * BLOCK_SIZE, BUFFER_SIZE) - 1;
+        addWriteOperation(startOffset, endOffset);
+    };
+
+    size_t shardCount = (dirtyBlocks.size() + SCAN_SHARD_BLOCKS - 1) / SCAN_SHARD_BLOCKS;
+    if (shardCount <= 1 || scanPool->size() <= 1) {
+        dirtyBlocks.drain(addRun);
+        return;
+    }
+
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> shardRuns(shardCount);
+    scanPool->forEach(shardCount, [this, &shardRuns](size_t shard) {
+        dirtyBlocks.drain(shard * SCAN_SHARD_BLOCKS, SCAN_SHARD_BLOCKS,
+                          [&runs = shardRuns[shard]](uint64_t firstBlock, uint64_t blockCount) { runs.emplace_back(firstBlock, blockCount); });
+    });
 
-        addWriteOperation(diffStart, diffEnd);
-        startOffset = diffEnd + 1;
+    // Runs that continue across a shard boundary are joined, as a sequential drain would have reported them
+    uint64_t runStart = 0;
+    uint64_t runLength = 0;
+    for (const auto& runs : shardRuns) {
+        for (const auto& [firstBlock, blockCount] : runs) {
+            if (runLength != 0 && runStart + runLength == firstBlock) {
+                runLength += blockCount;
+                continue;
+            }
+            if (runLength != 0)
+                addRun(runStart, runLength);
+            runStart = firstBlock;
+            runLength = blockCount;
+        }
     }
+    if (runLength != 0)
+        addRun(runStart, runLength);
+}
+
+void BuseManager::setScanThreads(size_t threads) {
+    std::lock_guard<std::mutex> lock(syncMutex);
+    if (threads == 0)
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    if (!scanPool || scanPool->size() != threads)
+        scanPool = std::make_unique<ThreadPool>(threads);
 }
 
-void BuseManager::synchronizeData() {
-    std::lock_guard<std::mutex> lock(writeMutex);
-    consolidateWriteOperations();
+void BuseManager::setSyncPipeline(uint32_t batchBytes, size_t window, uint32_t maxTransfer) {
+    std::lock_guard<std::mutex> lock(syncMutex);
+    // A batch, and an extent that fills a batch on its own, must stay within what one request may carry
+    if (batchBytes > REMOTE_MAX_PAYLOAD || maxTransfer > REMOTE_MAX_PAYLOAD)
+        LOG_F(WARNING, "Limiting sync batches and transfers to %u bytes", REMOTE_MAX_PAYLOAD);
+    syncBatchBytes = std::clamp<uint32_t>(batchBytes, BLOCK_SIZE, REMOTE_MAX_PAYLOAD);
+    syncWindow = std::max<size_t>(window, 1);
+    // Whole blocks only: staging and copy-on-write work on block-aligned ranges
+    this->maxTransfer = std::clamp<uint32_t>(maxTransfer / BLOCK_SIZE * BLOCK_SIZE, BLOCK_SIZE, REMOTE_MAX_PAYLOAD);
+}
+
+bool BuseManager::synchronizeData() {
+    std::lock_guard<std::mutex> syncLock(syncMutex);
+    uint64_t epoch;
+    blockPushes();
+    {
+        // Writers see the syncing set as soon as they can write again, so none slips between snapshot and COW
+        RangeGuard lock(rangeLocks, 0, BUFFER_SIZE, true);
+        {
+            // Taken before draining, so a flush that still saw the previous epoch is covered by this snapshot
+            std::lock_guard<std::mutex> epochLock(epochMutex);
+            epoch = ++startedEpoch;
+            writeEpoch.store(epoch + 1);
+        }
+        consolidateWriteOperations();
+        for (const auto& op : writeOps) {
+            syncingBlocks.set(op.offset / BLOCK_SIZE, (op.len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        zeroBlocks.drain([this](uint64_t firstBlock, uint64_t blockCount) {
+            uint64_t start = firstBlock * BLOCK_SIZE;
+            zeroOps.emplace_back(start, std::min((firstBlock + blockCount) * BLOCK_SIZE, BUFFER_SIZE) - start);
+            roundBlocks.set(firstBlock, blockCount);
+        });
+        for (const auto& op : writeOps) {
+            roundBlocks.set(op.offset / BLOCK_SIZE, (op.len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+    }
+    unblockPushes();
+    if (writeOps.empty() && zeroOps.empty()) {
+        completeEpoch(epoch, true);  // Earlier rounds either made their data durable or left it dirty
+        return true;
+    }
 
+    uint64_t bytes = 0;
     for (const auto& op : writeOps) {
-        std::memcpy(remoteBuffer.get() + op.offset, buffer.get() + op.offset, op.len);
-        // LOG_F(INFO, "Synced %lu, %u", op.offset, op.len);
+        bytes += op.len;
+    }
+    uint64_t zeroBytes = 0;
+    for (const auto& [offset, len] : zeroOps) {
+        zeroBytes += len;
+    }
+
+    // Stage and upload a window's worth at a time, so staging memory stays bounded by the pipeline depth
+    const uint64_t chunkLimit = static_cast<uint64_t>(syncBatchBytes) * syncWindow;
+    std::vector<RemoteExtent> extents;
+    auto start = std::chrono::steady_clock::now();
+    bool synced = true;
+    size_t next = 0;
+    try {
+        for (const auto& [offset, len] : zeroOps) {
+            remote->zero(offset, len);
+            std::lock_guard<std::mutex> treeLock(treeMutex);
+            syncedTree.setZero(offset / BLOCK_SIZE, (len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        while (next < writeOps.size()) {
+            size_t first = next;
+            uint64_t used = 0;
+            {
+                std::lock_guard<std::mutex> lock(cowMutex);
+                while (next < writeOps.size() && (next == first || used + writeOps[next].len <= chunkLimit)) {
+                    if (staging.size() < used + writeOps[next].len)
+                        staging.resize(used + writeOps[next].len);
+                    stageRange(writeOps[next], staging.data() + used);
+                    used += writeOps[next].len;
+                    next++;
+                }
+            }
+
+            extents.clear();
+            used = 0;
+            for (size_t i = first; i < next; i++) {
+                extents.push_back(RemoteExtent{writeOps[i].offset, staging.data() + used, writeOps[i].len});
+                used += writeOps[i].len;
+            }
+            remote->putMany(extents.data(), extents.size(), syncBatchBytes, syncWindow);
+            std::lock_guard<std::mutex> treeLock(treeMutex);
+            for (const auto& extent : extents) {
+                syncedTree.setBlocks(extent.offset / BLOCK_SIZE, extent.data, extent.len);
+            }
+        }
+        remote->flush();
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Sync of %lu bytes failed: %s", bytes + zeroBytes, e.what());
+        // Nothing is durable until the flush succeeded, so keep every range for the next attempt
+        std::lock_guard<std::mutex> lock(cowMutex);
+        for (const auto& op : writeOps) {
+            markDirtyBlocks(op.offset / BLOCK_SIZE, (op.len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+            syncingBlocks.clear(op.offset / BLOCK_SIZE, (op.len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        for (const auto& [offset, len] : zeroOps) {
+            markZero(offset / BLOCK_SIZE, (len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        cowBlocks.clear();
+        hasWrites.store(true);
+        synced = false;
+    }
+    {
+        // Requeued on failure above, so a forced write waiting for these blocks finds them dirty again
+        std::lock_guard<std::mutex> pushLock(pushMutex);
+        for (const auto& op : writeOps) {
+            roundBlocks.clear(op.offset / BLOCK_SIZE, (op.len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        for (const auto& [offset, len] : zeroOps) {
+            roundBlocks.clear(offset / BLOCK_SIZE, (len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+    }
+    pushesChanged.notify_all();
+
+    if (synced) {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        LOG_F(INFO, "Synced %lu bytes in %zu ops, %.2f ms (%.1f MB/s)", bytes, writeOps.size(), ms, ms > 0 ? bytes / ms / 1000.0 : 0.0);
+        if (zeroBytes != 0)
+            LOG_F(INFO, "Zeroed %lu trimmed bytes in %zu ops", zeroBytes, zeroOps.size());
+        uint64_t rewritten = 0;
+        for (const auto& op : writeOps) {
+            for (uint64_t block = op.offset / BLOCK_SIZE; block < (op.offset + op.len + BLOCK_SIZE - 1) / BLOCK_SIZE; block++) {
+                rewritten += blockEpochs.get(block) > epoch;
+            }
+        }
+        if (rewritten != 0)
+            LOG_F(INFO, "%lu blocks were rewritten during the round and stay dirty for the next one", rewritten);
+
+        blockPushes();
+        try {
+            std::vector<uint64_t> divergent = findDivergentBlocks();
+            uint64_t lost = 0;
+            for (uint64_t block : divergent) {
+                if (missingBlocks.test(block)) {
+                    // Not fetched yet, so the remote contents are the device's and only the tree is stale
+                    uint64_t hash;
+                    remote->hashes(0, block, 1, &hash);
+                    syncedTree.setHashes(block, &hash, 1);
+                } else {
+                    markDirtyBlocks(block, 1);
+                    lost++;
+                }
+            }
+            if (!divergent.empty()) {
+                LOG_F(ERROR, "buffer and remote store are not in sync, %zu blocks differ and are synced again", divergent.size());
+                hasWrites.store(true);
+            }
+            // The remote is missing data this round was to make durable, so its flushes wait for the next one
+            if (lost != 0) {
+                deferFlushes(epoch);
+                synced = false;
+            } else {
+                divergentRounds = 0;
+            }
+        } catch (const std::exception& e) {
+            LOG_F(ERROR, "Comparing hash trees with the remote store failed: %s", e.what());
+        }
+        unblockPushes();
     }
     writeOps.clear();
+    zeroOps.clear();
+    completeEpoch(epoch, synced);
+    return synced;
+}
+
+void BuseManager::deferFlushes(uint64_t epoch) {
+    if (++divergentRounds > MAX_DIVERGENT_ROUNDS) {
+        LOG_F(ERROR, "The remote store lost data %u rounds in a row, failing the flushes waiting for it", MAX_DIVERGENT_ROUNDS);
+        divergentRounds = 0;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(epochMutex);
+        for (auto& waiter : flushWaiters) {
+            waiter.first = std::max(waiter.first, epoch + 1);
+        }
+    }
+    std::lock_guard<std::mutex> lock(lockMutex);
+    flushRequested = true;
+    intervalCV.notify_all();
+}
+
+void BuseManager::blockPushes() {
+    std::unique_lock<std::mutex> pushLock(pushMutex);
+    pushesBlocked = true;
+    pushesChanged.wait(pushLock, [this] { return rangePushes == 0; });
+}
+
+void BuseManager::unblockPushes() {
+    {
+        std::lock_guard<std::mutex> pushLock(pushMutex);
+        pushesBlocked = false;
+    }
+    pushesChanged.notify_all();
+}
+
+bool BuseManager::syncRange(uint64_t offset, uint64_t len) {
+    if (len == 0)
+        return true;
+    uint64_t firstBlock = offset / BLOCK_SIZE;
+    uint64_t endBlock = (offset + len - 1) / BLOCK_SIZE + 1;
+    uint64_t start = firstBlock * BLOCK_SIZE;
+    uint64_t end = std::min(endBlock * BLOCK_SIZE, BUFFER_SIZE);
+    // Uploads of the same block must reach the remote store in order, so only one may be in flight at a time
+    auto mayPush = [&] {
+        if (pushesBlocked)
+            return false;
+        for (uint64_t block = firstBlock; block < endBlock; block++) {
+            if (roundBlocks.test(block) || pushingBlocks.test(block))
+                return false;
+        }
+        return true;
+    };
+
+    std::vector<WriteOp> ops;
+    std::vector<std::pair<uint64_t, uint64_t>> zeros;
+    std::vector<char> data;
+    while (true) {
+        {
+            // Writers, trims and snapshots of these blocks need the range exclusively, so the bits cannot change
+            RangeGuard lock(rangeLocks, start, end - start, false);
+            std::lock_guard<std::mutex> pushLock(pushMutex);
+            if (mayPush()) {
+                for (uint64_t block = firstBlock; block < endBlock; block++) {
+                    bool dirty = dirtyBlocks.test(block);
+                    bool zero = zeroBlocks.test(block);
+                    if (!dirty && !zero)
+                        continue;
+                    // A dirty block is uploaded whole, which also covers a zero pending for it
+                    dirtyBlocks.clear(block, 1);
+                    zeroBlocks.clear(block, 1);
+                    uint64_t blockStart = block * BLOCK_SIZE;
+                    if (!dirty) {
+                        if (!zeros.empty() && zeros.back().first + zeros.back().second == blockStart)
+                            zeros.back().second += blockLength(block);
+                        else
+                            zeros.emplace_back(blockStart, blockLength(block));
+                    } else if (!ops.empty() && ops.back().offset + ops.back().len == blockStart) {
+                        ops.back().len += static_cast<uint32_t>(blockLength(block));
+                    } else {
+                        ops.push_back(WriteOp{blockStart, static_cast<uint32_t>(blockLength(block))});
+                    }
+                }
+                if (ops.empty() && zeros.empty())
+                    return true;
+                // Not part of the running round, whose blocks were excluded above, so no copy-on-write image applies
+                data.resize(ops.empty() ? 0 : end - start);
+                for (const auto& op : ops) {
+                    std::memcpy(data.data() + (op.offset - start), buffer.get() + op.offset, op.len);
+                }
+                pushingBlocks.set(firstBlock, endBlock - firstBlock);
+                rangePushes++;
+                break;
+            }
+        }
+        std::unique_lock<std::mutex> pushLock(pushMutex);
+        pushesChanged.wait(pushLock, mayPush);
+    }
+
+    RemoteStore& store = rangeRemote ? *rangeRemote : *remote;
+    std::vector<RemoteExtent> extents;
+    for (const auto& op : ops) {
+        extents.push_back(RemoteExtent{op.offset, data.data() + (op.offset - start), op.len});
+    }
+    bool synced = true;
+    try {
+        for (const auto& [zeroOffset, zeroLen] : zeros) {
+            store.zero(zeroOffset, zeroLen);
+            std::lock_guard<std::mutex> treeLock(treeMutex);
+            syncedTree.setZero(zeroOffset / BLOCK_SIZE, (zeroLen + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        store.putMany(extents.data(), extents.size(), syncBatchBytes, syncWindow);
+        {
+            std::lock_guard<std::mutex> treeLock(treeMutex);
+            for (const auto& extent : extents) {
+                syncedTree.setBlocks(extent.offset / BLOCK_SIZE, extent.data, extent.len);
+            }
+        }
+        store.flush();
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Sync of range %lu, %lu failed: %s", offset, len, e.what());
+        for (const auto& op : ops) {
+            markDirtyBlocks(op.offset / BLOCK_SIZE, (op.len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        for (const auto& [zeroOffset, zeroLen] : zeros) {
+            markZero(zeroOffset / BLOCK_SIZE, (zeroLen + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        hasWrites.store(true);
+        synced = false;
+    }
+    {
+        std::lock_guard<std::mutex> pushLock(pushMutex);
+        pushingBlocks.clear(firstBlock, endBlock - firstBlock);
+        rangePushes--;
+    }
+    pushesChanged.notify_all();
+    return synced;
+}
+
+std::vector<uint64_t> BuseManager::findDivergentBlocks() {
+    static_assert(BLOCK_SIZE == HASH_BLOCK_SIZE);
+    uint32_t level = syncedTree.height() - 1;
+    uint64_t remoteRoot;
+    remote->hashes(level, 0, 1, &remoteRoot);
+    if (remoteRoot == syncedTree.root())
+        return {};
+
+    std::vector<uint64_t> differing{0};  // Differing nodes of the current level, ascending
+    std::vector<uint64_t> next;
+    std::vector<uint64_t> remoteNodes;
+    while (level > 0 && !differing.empty()) {
+        level--;
+        next.clear();
+        // The children of a run of consecutive parents are consecutive too, so each run is fetched at once
+        size_t i = 0;
+        while (i < differing.size()) {
+            size_t j = i + 1;
+            while (j < differing.size() && differing[j] == differing[j - 1] + 1) {
+                j++;
+            }
+            uint64_t first = differing[i] * 2;
+            uint64_t count = std::min(differing[j - 1] * 2 + 2, syncedTree.width(level)) - first;
+            remoteNodes.resize(count);
+            remote->hashes(level, first, count, remoteNodes.data());
+            for (uint64_t k = 0; k < count; k++) {
+                if (remoteNodes[k] != syncedTree.node(level, first + k))
+                    next.push_back(first + k);
+            }
+            i = j;
+        }
+        differing.swap(next);
+    }
+    // A short last block is a full one on a larger remote store, so its hashes never match
+    if (!differing.empty() && differing.back() == syncedTree.width(0) - 1 && BUFFER_SIZE % BLOCK_SIZE != 0 && remote->size() > BUFFER_SIZE)
+        differing.pop_back();
+    return differing;
+}
+
+bool BuseManager::verifyRemote() {
+    constexpr uint32_t CHUNK_SIZE = 1024 * 1024;
+    static_assert(VERIFY_SHARD_SIZE % CHUNK_SIZE == 0 && CHUNK_SIZE % BLOCK_SIZE == 0 && BLOCK_SIZE == COMPARE_BLOCK_SIZE);
+    std::lock_guard<std::mutex> syncLock(syncMutex);
+    RangeGuard lock(rangeLocks, 0, BUFFER_SIZE, true);
+    size_t shardCount = (BUFFER_SIZE + VERIFY_SHARD_SIZE - 1) / VERIFY_SHARD_SIZE;
+    std::vector<std::vector<uint64_t>> shardBlocks(shardCount);  // Differing blocks, ascending within a shard
+    LOG_F(INFO, "Comparing %lu bytes against the remote store in %zu shards on %zu threads using the %s kernel", BUFFER_SIZE,
+          shardCount, scanPool->size(), compareBlocksKernel());
+
+    try {
+        scanPool->forEach(shardCount, [this, &shardBlocks](size_t shard) {
+            // A connection of its own, so the shards are fetched in parallel instead of taking turns on one socket
+            std::unique_ptr<RemoteStore> connection;
+            if (!remoteEndpoint.empty())
+                connection = std::make_unique<TcpRemoteStore>(remoteEndpoint);
+            RemoteStore& store = connection ? *connection : *remote;
+
+            std::vector<char> chunk(CHUNK_SIZE);
+            std::vector<uint64_t> mask((CHUNK_SIZE / BLOCK_SIZE + 64) / 64);
+            uint64_t shardEnd = std::min<uint64_t>((shard + 1) * VERIFY_SHARD_SIZE, BUFFER_SIZE);
+            for (uint64_t offset = shard * VERIFY_SHARD_SIZE; offset < shardEnd; offset += CHUNK_SIZE) {
+                uint32_t len = static_cast<uint32_t>(std::min<uint64_t>(CHUNK_SIZE, shardEnd - offset));
+                store.get(offset, chunk.data(), len);
+                if (compareBlocks(chunk.data(), buffer.get() + offset, len, mask.data()) == 0)
+                    continue;
+                for (uint64_t w = 0; w < mask.size(); w++) {
+                    for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+                        uint64_t block = offset / BLOCK_SIZE + w * 64 + __builtin_ctzll(bits);
+                        if (!missingBlocks.test(block))  // Missing blocks are by definition what the remote holds
+                            shardBlocks[shard].push_back(block);
+                    }
+                }
+            }
+        });
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Verification failed: %s", e.what());
+        return false;
+    }
+
+    uint64_t differingBlocks = 0;
+    for (const auto& blocks : shardBlocks) {
+        for (uint64_t block : blocks) {
+            markDirtyBlocks(block, 1);
+        }
+        differingBlocks += blocks.size();
+    }
 
-    if (memcmp(buffer.get(), remoteBuffer.get(), BUFFER_SIZE) != 0) {
-        LOG_F(ERROR, "buffer and remoteBuffer are not in sync");
+    if (differingBlocks != 0) {
+        LOG_F(ERROR, "buffer and remote store are not in sync, %lu blocks differ", differingBlocks);
+        hasWrites.store(true);
+        return false;
     }
+    return true;
 }
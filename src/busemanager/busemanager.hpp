@@ -1,13 +1,37 @@
 #ifndef BUSE_MANAGER_H
 #define BUSE_MANAGER_H
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-constexpr uint64_t MAX_WRITE_LENGTH = 4096;
+#include "blockbitmap.hpp"
+#include "blockepochs.hpp"
+#include "hashtree.hpp"
+#include "journal.hpp"
+#include "mappedbuffer.hpp"
+#include "remotestore.hpp"
+#include "sequentialdetector.hpp"
+#include "stripedlock.hpp"
+#include "threadpool.hpp"
+
+constexpr uint64_t BLOCK_SIZE = 4096;
+constexpr uint64_t SCAN_SHARD_BLOCKS = 256 * 1024;          // Dirty map shard scanned by one task, 1 GiB of device
+constexpr uint64_t VERIFY_SHARD_SIZE = 64 * 1024 * 1024;  // Device bytes compared by one verification task
+constexpr uint64_t HYDRATE_CHUNK_SIZE = 1024 * 1024;        // Longest range fetched by one hydration request
+constexpr uint64_t READAHEAD_MIN_WINDOW = 128 * 1024;       // Readahead of a newly detected sequential stream
+constexpr size_t READAHEAD_THREADS = 2;
+constexpr size_t READAHEAD_QUEUE_DEPTH = 8;  // Readaheads queued at most; further ones are dropped
+constexpr uint64_t JOURNAL_MAX_PENDING = 8 * 1024 * 1024;  // Queued journal payload that forces a commit
+constexpr uint32_t MAX_DIVERGENT_ROUNDS = 3;  // Rounds a flush is deferred for a remote missing data before it fails
 
 struct WriteOp {
     uint64_t offset;
@@ -16,7 +40,26 @@ struct WriteOp {
 
 class BuseManager {
    public:
-    explicit BuseManager(uint64_t bufferSize = 0);
+    /**
+     * @brief Maps the local buffer and opens the remote store.
+     * @param bufferSize The device size in bytes, or 0 to take it from an existing image file.
+     * @param imagePath Optional image file backing the local buffer; anonymous memory is used if empty.
+     * @param remoteEndpoint Optional host:port of a buse_remote server; an in-memory store is used if empty.
+     * @param hydrate Whether to start from the contents of the remote store instead of the local buffer.
+     * @param overwriteRemote Whether a TCP remote store holding other data than the buffer may be overwritten.
+     *
+     * Blocks holding data in an existing image file are marked dirty, so the first synchronization ships them.
+     *
+     * Unless hydrating, the block hashes of a TCP remote store are adopted as what it holds, so the first check
+     * does not take its data for blocks lost in transit. Blocks holding data there that differ from the buffer
+     * refuse the start with EEXIST, unless overwriteRemote marks them dirty to be replaced.
+     *
+     * When hydrating, a bufferSize of 0 takes the size of the remote store and an existing image is cleared.
+     * Only the block hashes of the remote store are fetched up front: blocks hashing as zeros are already in
+     * place, every other block is missing until hydrate() or the background hydration fetches it.
+     */
+    explicit BuseManager(uint64_t bufferSize = 0, const std::string& imagePath = "", const std::string& remoteEndpoint = "",
+                         bool hydrate = false, bool overwriteRemote = false);
     ~BuseManager();
 
     /**
@@ -27,6 +70,58 @@ class BuseManager {
      */
     void runPeriodicSync();
 
+    /**
+     * @brief Makes every write acknowledged so far durable on the remote store.
+     * @return true once a synchronization round that started after the call has completed.
+     *
+     * Blocks until flushAsync() reports the result.
+     */
+    bool flush();
+
+    /**
+     * @brief Requests a flush and reports its result without blocking.
+     * @param done Called with true once a synchronization round that started after the request has made its
+     * snapshot durable, or with false if that round failed. Usually runs on the synchronization thread.
+     *
+     * Rounds are numbered by epoch. The flush only waits for the next epoch to start and complete, so its
+     * latency is that of the data still dirty rather than a synchronization on the caller's thread, and
+     * several flushes arriving together share one round. The synchronization thread is woken instead of
+     * waiting for its interval; if it is not running, the round runs on the calling thread.
+     */
+    void flushAsync(std::function<void(bool)> done);
+
+    /**
+     * @brief Returns the block-aligned byte ranges modified after the round of the given epoch took its snapshot.
+     * @param epoch An epoch as returned by getStartedEpoch(), or 0 for everything ever modified.
+     * @return Pairs of offset and length in ascending order.
+     *
+     * Writes, trims and ranges a failed round put back all count as modifications.
+     */
+    std::vector<std::pair<uint64_t, uint64_t>> changedSince(uint64_t epoch) const;
+
+    /**
+     * @brief Returns whether every modification made so far is durable on the remote store.
+     *
+     * A single comparison of the newest block epoch against the last durable round. Ranges made durable by
+     * syncRange() only count once the next round completes, so the answer errs on the side of false.
+     */
+    bool isDurable() const;
+
+    /**
+     * @brief Returns whether every modification of the blocks covering a byte range is durable.
+     */
+    bool isDurable(uint64_t offset, uint64_t len) const;
+
+    /**
+     * @brief Returns the epoch of the latest round that has taken its snapshot.
+     */
+    uint64_t getStartedEpoch();
+
+    /**
+     * @brief Returns the epoch of the latest round whose snapshot is durable.
+     */
+    uint64_t getDurableEpoch();
+
     /**
      * @brief Stops the synchronization thread.
      *
@@ -48,53 +143,430 @@ class BuseManager {
     std::atomic<bool>& getHasWrites() { return hasWrites; }
 
     /**
-     * @brief Synchronizes data between local and remote buffers immediately.
+     * @brief Marks the blocks covering a byte range as dirty so the next synchronization picks them up.
+     * @param offset The starting offset of the modified range.
+     * @param len The length of the modified range.
+     *
+     * Must be called after the data has been written to the buffer, with the range still locked exclusively in
+     * rangeLocks. The checksums of the blocks are recomputed if enabled, and the blocks are stamped with the
+     * epoch of the round that will pick them up.
+     */
+    void markDirty(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Fetches the blocks of a byte range still missing from a hydrating buffer.
+     * @param offset The starting offset of the range.
+     * @param len The length of the range.
+     * @return false if the blocks could not be fetched from the remote store.
+     *
+     * Must be called before the range is locked in rangeLocks. Returns immediately once every block is present.
+     * The data is fetched without holding any lock and only installed into blocks that are still missing, so
+     * blocks written or trimmed meanwhile keep their new contents.
+     */
+    bool hydrate(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Like hydrate(), but only fetches the blocks a write of the range covers partially.
+     *
+     * Blocks a write covers completely are made present by markDirty() without fetching them.
+     */
+    bool hydrateEdges(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Starts fetching every missing block in the background.
+     * @param threads The number of threads, each with its own connection to the remote store, or 0 for one per
+     * core.
+     *
+     * The device is split into HYDRATE_CHUNK_SIZE chunks handed out to the threads in order. Does nothing if no
+     * block is missing. The threads stop with stopSyncThread().
+     */
+    void startHydration(size_t threads);
+
+    /**
+     * @brief Enables readahead for sequential read streams.
+     * @param maxWindow The largest window a stream's readahead grows to, or 0 to disable readahead.
+     *
+     * Must be called before any read is passed to noteRead().
+     */
+    void setReadahead(uint64_t maxWindow);
+
+    /**
+     * @brief Feeds a read to the sequential stream detector and reads ahead of the stream it continues.
+     * @param offset The starting offset of the read.
+     * @param len The length of the read.
+     *
+     * Readahead runs on background threads and only pays off where data is not in memory yet: missing blocks
+     * of a hydrating buffer are fetched from the remote store, and pages of an image file are read into the
+     * page cache with MappedBuffer::prefetch(). Does nothing, and takes no lock, for a fully present anonymous
+     * buffer; otherwise it takes the lock of the detector shard of the read's region. Must be called before the
+     * range is locked in rangeLocks.
+     */
+    void noteRead(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Opens a write-ahead journal and replays the modifications it holds onto the buffer.
+     * @param dir The directory of the journal segments, created if it does not exist.
+     * @param syncWrites Whether commitWrite() makes every modification durable, or only bounds the queue and
+     * leaves durability to commitJournal() on flush and forced unit access.
+     * @throws std::system_error if the journal cannot be opened or replayed.
+     *
+     * From then on every write and trim is appended to the journal, and segments are deleted once a round has
+     * made their modifications durable on the remote store, after the image file has been synced. Replayed
+     * modifications are marked dirty like any write, so they reach the remote store with the next round. The
+     * journal restores writes on top of the state they were made to, so it is meant for an image file or a
+     * hydrated buffer. Must be called before requests are served.
+     */
+    void openJournal(const std::string& dir, bool syncWrites);
+
+    /**
+     * @brief Returns whether modifications are journaled.
+     */
+    bool hasJournal() const { return journal != nullptr; }
+
+    /**
+     * @brief Commits the journal as required after a modification, before it is acknowledged.
+     * @return false if the journal failed to make the modification durable.
+     *
+     * Commits every modification when journaling synchronous writes; otherwise only once JOURNAL_MAX_PENDING
+     * bytes are queued. Must be called with no range locked, as it may wait for a sync of the journal. Always
+     * succeeds without a journal.
+     */
+    bool commitWrite();
+
+    /**
+     * @brief Makes every modification journaled so far durable in the journal.
+     * @return false if the journal failed to write or sync them, true also without a journal.
+     */
+    bool commitJournal();
+
+    /**
+     * @brief Starts keeping a CRC32C checksum of every block, which verifyChecksums() checks reads against.
+     *
+     * Off by default, as it costs a checksum of every written block with its range locked; the overhead is
+     * measured by crc32c_bench. Must be called before requests are served, openJournal() and startHydration().
+     */
+    void enableChecksums();
+
+    /**
+     * @brief Checks the blocks covering a byte range against their checksums.
+     * @param offset The starting offset of the range.
+     * @param len The length of the range.
+     * @return false if any block no longer matches the CRC32C recorded when it was last written.
+     *
+     * Blocks of an existing image that have not been written since startup have no checksum yet; it is taken
+     * from their contents on their first check. Always succeeds unless enableChecksums() was called. Must be
+     * called with the range locked in rangeLocks.
+     */
+    bool verifyChecksums(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Preserves the synced version of blocks about to be overwritten.
+     * @param offset The starting offset of the range about to be written.
+     * @param len The length of the range about to be written.
+     *
+     * Blocks that belong to the running synchronization round and have not been staged for upload yet are
+     * copied aside first, so the round uploads the point-in-time contents it started with. Must be called with
+     * the range locked exclusively in rangeLocks, before the data is written to the buffer.
+     */
+    void prepareWrite(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Discards the whole blocks of a byte range.
+     * @param offset The starting offset of the discarded range.
+     * @param len The length of the discarded range.
+     * @throws std::system_error if the backing pages cannot be released.
+     *
+     * The blocks are released from the buffer, read back as zeros, and leave the dirty set; the next
+     * synchronization clears them on the remote store with a zero request instead of uploading them. Partial
+     * blocks at the edges are left alone, as a discard is only a hint. Must be called with the range locked
+     * exclusively in rangeLocks.
+     */
+    void trim(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Zeroes a byte range, deallocating the whole blocks it covers unless asked to keep them.
+     * @param offset The starting offset of the zeroed range.
+     * @param len The length of the zeroed range.
+     * @param keepAllocated Whether the whole blocks are zeroed in place instead of released, as NBD_CMD_FLAG_NO_HOLE
+     * requires.
+     * @throws std::system_error if the backing pages cannot be released.
+     *
+     * Whole blocks are handled like trim(), so only their range is recorded and the remote store clears them
+     * with a zero request. Partial blocks at the edges are zeroed in the buffer and synced like any write.
+     * Must be called with the range locked exclusively in rangeLocks.
+     */
+    void zeroRange(uint64_t offset, uint64_t len, bool keepAllocated = false);
+
+    /**
+     * @brief Synchronizes data between the local buffer and the remote store immediately.
+     * @return true if every dirty block reached the remote store and was flushed there.
+     *
+     * This method forces an immediate synchronization of data between the local buffer and the remote store,
+     * processing any pending write operations. rangeLocks are only held while the dirty set is swapped out, so
+     * writes proceed during the transfer and are picked up by the next round, while prepareWrite() keeps
+     * copy-on-write images of rewritten blocks so the round stays a consistent point-in-time snapshot. Ranges
+     * that fail to upload stay dirty for the next attempt. Trimmed blocks are zeroed remotely before any
+     * data of the round is uploaded, so a block written again after its trim ends up with the new data.
+     *
+     * After the flush, the root of the hash tree of what was uploaded is compared with the remote one, one
+     * small request when both agree. Blocks found to differ are marked dirty for the next round, which the
+     * round's flushes then wait for, as the remote store does not hold what they were to make durable.
+     */
+    bool synchronizeData();
+
+    /**
+     * @brief Makes the blocks covering a byte range durable on the remote store.
+     * @param offset The starting offset of the range.
+     * @param len The length of the range.
+     * @return true if the range reached the remote store and was flushed there.
+     *
+     * Only the dirty and trimmed blocks of the range are uploaded, followed by a flush, so a forced unit access
+     * write costs a round trip for its own data instead of a synchronization of the whole device. The blocks are
+     * staged under the shared range lock and sent on a connection of their own, without syncMutex, so neither a
+     * running round nor forced writes to other blocks hold it up. It only waits for a round to take its snapshot
+     * or compare hash trees, for the running round if that has one of its blocks in flight, and for an earlier
+     * syncRange() of overlapping blocks: at most one round's upload and flush plus its own round trips. Blocks
+     * that fail to upload stay dirty for the next round.
+     */
+    bool syncRange(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Configures how synchronization uploads dirty ranges.
+     * @param batchBytes The payload size at which a batch of ranges is sent as one request.
+     * @param window The number of batches that may be in flight at once.
+     * @param maxTransfer The longest range a run of dirty blocks is uploaded as, rounded down to whole blocks.
      *
-     * This method forces an immediate synchronization of data between the local and remote buffers,
-     * processing any pending write operations.
+     * batchBytes and maxTransfer are limited to REMOTE_MAX_PAYLOAD. A batch also ends after
+     * REMOTE_MAX_BATCH_EXTENTS extents, however small they are.
      */
-    void synchronizeData();
+    void setSyncPipeline(uint32_t batchBytes, size_t window, uint32_t maxTransfer);
 
-    static std::unique_ptr<char[]> buffer;
-    static std::unique_ptr<char[]> remoteBuffer;
-    static std::mutex writeMutex;
+    /**
+     * @brief Sets the number of threads scanning the dirty map and verifying the remote store.
+     * @param threads The number of threads, or 0 for one per core.
+     */
+    void setScanThreads(size_t threads);
+
+    /**
+     * @brief Reads the whole remote store back and compares it with the local buffer.
+     * @return true if both hold the same data.
+     *
+     * Blocks that differ are marked dirty so the next synchronization repairs them. This costs a full
+     * transfer of the device and is meant for explicit verification, not for every synchronization. The
+     * device is split into shards that are fetched over connections of their own and compared in parallel on
+     * the scan threads.
+     */
+    bool verifyRemote();
+
+    static MappedBuffer buffer;
+    static StripedLock rangeLocks;  // Reads lock their range shared, writes exclusively
 
    private:
+    std::unique_ptr<RemoteStore> remote;
+    std::string remoteEndpoint;
+    std::unique_ptr<RemoteStore> faultRemote;  // Connection for hydrate(), so faults do not queue behind uploads
+    std::unique_ptr<RemoteStore> rangeRemote;  // Connection for syncRange(), so forced writes do not queue behind uploads
     std::vector<WriteOp> writeOps;
+    std::vector<std::pair<uint64_t, uint64_t>> zeroOps;  // Byte ranges the round clears remotely
+    std::mutex syncMutex;  // Serializes synchronization rounds and guards writeOps, zeroOps and divergentRounds
+    uint32_t divergentRounds = 0;  // Rounds in a row that found the remote store missing data
+    uint32_t syncBatchBytes = 1024 * 1024;
+    size_t syncWindow = 8;
+    uint32_t maxTransfer = 1024 * 1024;
+    std::unique_ptr<ThreadPool> scanPool;
+
+    BlockBitmap syncingBlocks;  // Blocks of the running round not yet staged for upload
+    std::unordered_map<uint64_t, std::unique_ptr<char[]>> cowBlocks;  // Preserved contents, by block
+    std::mutex cowMutex;  // Guards cowBlocks and staging against concurrent prepareWrite()
+    std::vector<char> staging;
+    std::mutex pushMutex;  // Guards the push state below
+    std::condition_variable pushesChanged;
+    BlockBitmap roundBlocks;    // Blocks the running round uploads or zeroes, until its flush completed
+    BlockBitmap pushingBlocks;  // Blocks of syncRange() uploads in flight
+    size_t rangePushes = 0;     // syncRange() uploads in flight
+    bool pushesBlocked = false;  // Set while a round takes its snapshot or compares hash trees
+    std::mutex treeMutex;  // Serializes changes to syncedTree
     std::atomic<bool> isRunning{true};
     std::atomic<bool> hasWrites{false};
-    std::mutex lockMutex;
+    std::mutex lockMutex;  // Guards the two flags below
     std::condition_variable intervalCV;
+    bool flushRequested = false;
+    bool syncThreadRunning = false;
+    std::mutex epochMutex;  // Guards the epochs and flushWaiters
+    uint64_t startedEpoch = 0;  // Rounds that have taken their snapshot
+    std::atomic<uint64_t> durableEpoch{0};  // Latest round whose snapshot is durable
+    std::atomic<uint64_t> writeEpoch{1};    // Epoch of the round that will pick up a modification made now
+    std::vector<std::pair<uint64_t, std::function<void(bool)>>> flushWaiters;  // Epoch each flush waits for
     const uint64_t SYNC_INTERVAL = 5;
     uint64_t BUFFER_SIZE;
+    BlockBitmap dirtyBlocks;
+    BlockBitmap zeroBlocks;  // Trimmed blocks not yet cleared on the remote store
+    BlockEpochs blockEpochs;  // Epoch each block was last modified in
+    std::unique_ptr<std::atomic<uint32_t>[]> blockChecksums;  // CRC32C of each block, written under rangeLocks, or null
+    BlockBitmap uncheckedBlocks;  // Image blocks whose checksum is taken on their first check
+    BlockBitmap missingBlocks;    // Blocks not fetched from the remote store yet, cleared under rangeLocks
+    std::atomic<uint64_t> missingCount{0};
+    std::vector<std::thread> hydrationThreads;
+    std::atomic<uint64_t> nextHydrationChunk{0};
+    std::atomic<size_t> runningHydrationThreads{0};
+    std::unique_ptr<SequentialDetector> readahead;
+    std::unique_ptr<RemoteStore> readaheadRemote;  // Connection readahead fetches missing blocks with
+    std::atomic<size_t> readaheadQueued{0};
+    HashTree syncedTree;      // Hashes of the contents last sent to the remote store, changed under treeMutex
+    std::unique_ptr<Journal> journal;
+    bool journalSyncWrites = true;
+    std::unique_ptr<ThreadPool> readaheadPool;  // Declared last, so its tasks finish before anything they use goes
 
     /**
      * @brief Consolidates write operations in the queue.
      *
-     * This method consolidates overlapping or adjacent write operations in the queue to optimize
-     * the synchronization process.
+     * This method drains the dirty block bitmap and turns every run of dirty blocks into write operations,
+     * so the cost of a synchronization is proportional to the amount of data written since the last one.
+     * Devices larger than one SCAN_SHARD_BLOCKS shard are drained shard by shard on the scan threads and the
+     * per-shard runs merged in device order, which keeps the exclusive snapshot short on large devices.
      */
     void consolidateWriteOperations();
 
+    /**
+     * @brief Marks blocks dirty and stamps them with the current write epoch, leaving their checksums alone.
+     *
+     * Used to requeue blocks whose contents did not change, which needs no range lock.
+     */
+    void markDirtyBlocks(uint64_t firstBlock, uint64_t blockCount);
+
+    /**
+     * @brief Queues blocks to be cleared on the remote store and stamps them with the current write epoch.
+     */
+    void markZero(uint64_t firstBlock, uint64_t blockCount);
+
+    /**
+     * @brief Zeroes the whole blocks of a byte range and queues them to be cleared on the remote store.
+     * @param deallocate Whether the blocks are released from the buffer, as by trim(), or zeroed in place.
+     *
+     * Must be called with the range locked exclusively in rangeLocks.
+     */
+    void clearBlocks(uint64_t offset, uint64_t len, bool deallocate);
+
+    /**
+     * @brief Returns the checksum of a zero-filled block.
+     */
+    uint32_t zeroChecksum(uint64_t block) const;
+
+    /**
+     * @brief Adopts the block hashes of the remote store as what it holds.
+     * @param hydrate Whether every block that is not zero there becomes missing, or has to match the buffer.
+     * @param overwrite Whether blocks that do not match the buffer are marked dirty, so the first round replaces them.
+     * @return The number of missing blocks when hydrating, else the number of blocks not matching the buffer.
+     * @throws std::system_error if the hashes cannot be fetched.
+     */
+    uint64_t seedFromRemote(bool hydrate, bool overwrite);
+
+    /**
+     * @brief Like hydrate(), fetching with the given connection.
+     */
+    bool hydrate(RemoteStore& store, uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Fetches the missing blocks among [firstBlock, endBlock) with one request and installs them.
+     * @param store The connection to fetch with.
+     * @param firstBlock The first block of the range, which spans at most HYDRATE_CHUNK_SIZE.
+     * @param endBlock The block after the range.
+     * @param scratch Receives the fetched data before it is installed.
+     *
+     * Locks the fetched range exclusively while installing, so it must be called without rangeLocks held.
+     */
+    void fetchMissing(RemoteStore& store, uint64_t firstBlock, uint64_t endBlock, std::vector<char>& scratch);
+
+    /**
+     * @brief Marks blocks present without fetching them, as their contents were just replaced. Must be called
+     * with the blocks locked exclusively in rangeLocks.
+     */
+    void settleMissing(uint64_t firstBlock, uint64_t blockCount);
+
+    /**
+     * @brief Body of a background hydration thread.
+     */
+    void runHydration();
+
+    /**
+     * @brief Finds the blocks whose remote contents differ from what was last sent there.
+     * @return The differing blocks in ascending order.
+     * @throws std::system_error if the remote hashes cannot be fetched.
+     *
+     * Compares syncedTree with the remote tree from the root down, only fetching the children of nodes that
+     * differ, so an in-sync store costs one request and each divergent block a request per tree level at
+     * most. A remote store larger than the buffer makes the nodes straddling the end of the buffer differ,
+     * which costs a descent along that edge but reports no blocks; a short last block cannot be checked
+     * then. Must be called with syncMutex held and pushes blocked.
+     */
+    std::vector<uint64_t> findDivergentBlocks();
+
+    /**
+     * @brief Holds off new syncRange() uploads and waits for those in flight to complete.
+     *
+     * Taken around the snapshot, so a forced write that fails is requeued before the round it belongs to, and
+     * around the hash tree comparison, so neither tree changes under it.
+     */
+    void blockPushes();
+
+    /**
+     * @brief Lets syncRange() uploads start again.
+     */
+    void unblockPushes();
+
+    /**
+     * @brief Records the outcome of a synchronization round and completes the flushes waiting for it.
+     * @param epoch The epoch of the round.
+     * @param durable Whether the round's snapshot reached the remote store.
+     */
+    void completeEpoch(uint64_t epoch, bool durable);
+
+    /**
+     * @brief Moves the flushes waiting for a round that found the remote store missing data to the next round.
+     * @param epoch The epoch of the round.
+     *
+     * The round is not durable then, so neither durableEpoch nor the journal advance. After MAX_DIVERGENT_ROUNDS
+     * such rounds in a row the flushes are left to fail with the round instead. Must be called with syncMutex held.
+     */
+    void deferFlushes(uint64_t epoch);
+
+    /**
+     * @brief Returns whether any flush is still waiting for a round.
+     */
+    bool hasFlushWaiters();
+
+    /**
+     * @brief Deletes the journal segments made redundant by a durable round.
+     * @param epoch The epoch of the round.
+     *
+     * The image file is synced first, as blocks last written in those segments are only kept there afterwards.
+     */
+    void retireJournal(uint64_t epoch);
+
+    /**
+     * @brief Copies the snapshot contents of a block-aligned range into the staging buffer.
+     * @param op The range to stage.
+     * @param dest Where to copy it.
+     *
+     * Preserved copy-on-write images are used where present and released. Must be called with cowMutex held.
+     */
+    void stageRange(const WriteOp& op, char* dest);
+
+    /**
+     * @brief Returns the length of a block, which is shorter than BLOCK_SIZE for the last one.
+     */
+    uint64_t blockLength(uint64_t block) const { return std::min(BLOCK_SIZE, BUFFER_SIZE - block * BLOCK_SIZE); }
+
     /**
      * @brief Adds a write operation to the queue.
      * @param startOffset The starting offset of the write operation.
      * @param endOffset The ending offset of the write operation.
      *
      * This method adds a write operation defined by its start and end offsets to the queue of operations
-     * to be processed during synchronization.
+     * to be processed during synchronization. The range is one run of dirty blocks, already coalesced by the
+     * bitmap, and is only split where it exceeds maxTransfer.
      */
     void addWriteOperation(uint64_t startOffset, uint64_t endOffset);
-
-    /**
-     * @brief Finds the next difference between local and remote buffers starting from a given offset.
-     * @param startOffset The offset from which to start searching for differences.
-     * @return A pair of offsets indicating the start and end of the next difference.
-     *
-     * This method scans the buffers starting from the specified offset to find the next range where the local
-     * and remote buffers differ. It returns a pair of offsets indicating the start and end of this range.
-     */
-    std::pair<uint64_t, uint64_t> findNextDifference(uint64_t startOffset);
 };
 
 #endif  // BUSE_MANAGER_H
\ No newline at end of file
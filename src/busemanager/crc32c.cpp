@@ -0,0 +1,144 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86
+#endif
+
+#include "crc32c.hpp"
+
+namespace {
+
+constexpr uint32_t POLY = 0x82f63b78;  // Castagnoli polynomial, bit-reversed
+constexpr uint64_t STREAM_SIZE = 256;  // Bytes per stream of the interleaved kernel
+
+// The kernels work on the raw CRC register; crc32c() applies the standard pre- and post-inversion
+using CrcFn = uint32_t (*)(uint32_t crc, const char* data, uint64_t len);
+
+struct Tables {
+    uint32_t bytewise[256];
+    uint32_t shift[4][256];  // Advances a register over STREAM_SIZE zero bytes, one table per register byte
+
+    Tables() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t crc = n;
+            for (int k = 0; k < 8; k++) {
+                crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+            }
+            bytewise[n] = crc;
+        }
+
+        // Appending zeros is linear in the register, so it is a 32x32 matrix over GF(2): start from the
+        // operator for one zero bit and square it up to STREAM_SIZE bytes, which is a power of two
+        uint32_t op[32];
+        uint32_t square[32];
+        op[0] = POLY;
+        for (int n = 1; n < 32; n++) {
+            op[n] = uint32_t{1} << (n - 1);
+        }
+        for (uint64_t bits = 1; bits < STREAM_SIZE * 8; bits *= 2) {
+            for (int n = 0; n < 32; n++) {
+                square[n] = times(op, op[n]);
+            }
+            std::memcpy(op, square, sizeof(op));
+        }
+        for (uint32_t n = 0; n < 256; n++) {
+            for (int byte = 0; byte < 4; byte++) {
+                shift[byte][n] = times(op, n << (8 * byte));
+            }
+        }
+    }
+
+    static uint32_t times(const uint32_t* matrix, uint32_t vector) {
+        uint32_t sum = 0;
+        for (; vector != 0; vector >>= 1, matrix++) {
+            if (vector & 1)
+                sum ^= *matrix;
+        }
+        return sum;
+    }
+
+    uint32_t shiftStream(uint32_t crc) const {
+        return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^ shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+    }
+};
+
+const Tables& tables() {
+    static const Tables built;
+    return built;
+}
+
+uint32_t crcScalar(uint32_t crc, const char* data, uint64_t len) {
+    const uint32_t* table = tables().bytewise;
+    for (uint64_t i = 0; i < len; i++) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+
+inline uint64_t load64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// The crc32 instruction has a latency of three cycles but a throughput of one, so three independent streams
+// keep it busy; their registers are then merged by advancing one over the length of the next
+__attribute__((target("sse4.2"))) uint32_t crcSse42(uint32_t crc, const char* data, uint64_t len) {
+    const Tables& t = tables();
+    uint64_t crc0 = crc;
+    while (len >= STREAM_SIZE * 3) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        for (uint64_t i = 0; i < STREAM_SIZE; i += 8) {
+            crc0 = _mm_crc32_u64(crc0, load64(data + i));
+            crc1 = _mm_crc32_u64(crc1, load64(data + STREAM_SIZE + i));
+            crc2 = _mm_crc32_u64(crc2, load64(data + 2 * STREAM_SIZE + i));
+        }
+        crc0 = t.shiftStream(static_cast<uint32_t>(crc0)) ^ crc1;
+        crc0 = t.shiftStream(static_cast<uint32_t>(crc0)) ^ crc2;
+        data += STREAM_SIZE * 3;
+        len -= STREAM_SIZE * 3;
+    }
+    for (; len >= 8; data += 8, len -= 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(data));
+    }
+    uint32_t tail = static_cast<uint32_t>(crc0);
+    for (; len > 0; data++, len--) {
+        tail = _mm_crc32_u8(tail, static_cast<uint8_t>(*data));
+    }
+    return tail;
+}
+
+#endif  // CRC32C_X86
+
+struct Kernel {
+    CrcFn update;
+    const char* name;
+};
+
+Kernel selectKernel() {
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        return {crcSse42, "sse4.2"};
+#endif
+    return {crcScalar, "scalar"};
+}
+
+const Kernel& kernel() {
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+}  // namespace
+
+uint32_t crc32c(const char* data, uint64_t len, uint32_t crc) {
+    return ~kernel().update(~crc, data, len);
+}
+
+const char* crc32cKernel() {
+    return kernel().name;
+}
@@ -0,0 +1,25 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstdint>
+
+/**
+ * @brief Computes the CRC32C (Castagnoli) checksum of a byte range.
+ *
+ * Uses the SSE4.2 crc32 instruction over three interleaved streams when the CPU supports it, picked once at
+ * runtime, and a table-driven implementation otherwise. Both produce the standard checksum, so values can be
+ * exchanged between machines.
+ *
+ * @param data The bytes to checksum.
+ * @param len The number of bytes.
+ * @param crc The checksum of the preceding bytes, to continue a running checksum, or 0 to start one.
+ * @return The checksum of everything checksummed so far.
+ */
+uint32_t crc32c(const char* data, uint64_t len, uint32_t crc = 0);
+
+/**
+ * @brief Returns the name of the kernel crc32c() dispatches to, e.g. "sse4.2".
+ */
+const char* crc32cKernel();
+
+#endif  // CRC32C_H
@@ -0,0 +1,158 @@
+#include <endian.h>
+#include <algorithm>
+#include <cstring>
+
+#include "hashtree.hpp"
+
+namespace {
+
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return le64toh(v);
+}
+
+inline uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return le32toh(v);
+}
+
+inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+inline uint64_t xxhMerge(uint64_t acc, uint64_t value) {
+    return (acc ^ xxhRound(0, value)) * PRIME1 + PRIME4;
+}
+
+// Hashes two child nodes, in a byte order fixed on the wire so both ends of a connection agree
+uint64_t hashPair(uint64_t left, uint64_t right) {
+    uint64_t pair[2] = {htole64(left), htole64(right)};
+    return hashBytes(reinterpret_cast<const char*>(pair), sizeof(pair));
+}
+
+uint64_t zeroBlockHash() {
+    static const uint64_t hash = [] {
+        std::vector<char> zeros(HASH_BLOCK_SIZE);
+        return hashBytes(zeros.data(), zeros.size());
+    }();
+    return hash;
+}
+
+}  // namespace
+
+uint64_t hashBytes(const char* data, uint64_t len) {
+    const char* p = data;
+    const char* end = data + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = PRIME1 + PRIME2;
+        uint64_t v2 = PRIME2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -PRIME1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxhRound(v1, read64(p));
+            v2 = xxhRound(v2, read64(p + 8));
+            v3 = xxhRound(v3, read64(p + 16));
+            v4 = xxhRound(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = xxhMerge(h, v1);
+        h = xxhMerge(h, v2);
+        h = xxhMerge(h, v3);
+        h = xxhMerge(h, v4);
+    } else {
+        h = PRIME5;
+    }
+
+    h += len;
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ xxhRound(0, read64(p)), 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = rotl(h ^ (static_cast<uint8_t>(*p) * PRIME5), 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+HashTree::HashTree(uint64_t size) : storageSize(size) {
+    uint64_t blocks = (size + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE;
+    levels.emplace_back(blocks);
+    while (levels.back().size() > 1) {
+        levels.emplace_back((levels.back().size() + 1) / 2);
+    }
+    if (blocks != 0)
+        setZero(0, blocks);
+}
+
+uint64_t HashTree::zeroHash(uint64_t block) const {
+    uint64_t len = std::min(HASH_BLOCK_SIZE, storageSize - block * HASH_BLOCK_SIZE);
+    if (len == HASH_BLOCK_SIZE)
+        return zeroBlockHash();
+    std::vector<char> zeros(len);
+    return hashBytes(zeros.data(), len);
+}
+
+void HashTree::setBlocks(uint64_t firstBlock, const char* data, uint64_t len) {
+    if (len == 0)
+        return;
+    uint64_t count = (len + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t offset = i * HASH_BLOCK_SIZE;
+        levels[0][firstBlock + i] = hashBytes(data + offset, std::min(HASH_BLOCK_SIZE, len - offset));
+    }
+    updateParents(firstBlock, firstBlock + count - 1);
+}
+
+void HashTree::setZero(uint64_t firstBlock, uint64_t count) {
+    if (count == 0)
+        return;
+    std::fill(levels[0].begin() + firstBlock, levels[0].begin() + firstBlock + count, zeroBlockHash());
+    if (firstBlock + count == levels[0].size())
+        levels[0].back() = zeroHash(levels[0].size() - 1);
+    updateParents(firstBlock, firstBlock + count - 1);
+}
+
+void HashTree::setHashes(uint64_t firstBlock, const uint64_t* hashes, uint64_t count) {
+    if (count == 0)
+        return;
+    std::copy(hashes, hashes + count, levels[0].begin() + firstBlock);
+    updateParents(firstBlock, firstBlock + count - 1);
+}
+
+void HashTree::nodes(uint32_t level, uint64_t first, uint64_t count, uint64_t* out) const {
+    std::copy(levels[level].begin() + first, levels[level].begin() + first + count, out);
+}
+
+void HashTree::updateParents(uint64_t first, uint64_t last) {
+    for (size_t level = 1; level < levels.size(); level++) {
+        const std::vector<uint64_t>& children = levels[level - 1];
+        first /= 2;
+        last /= 2;
+        for (uint64_t i = first; i <= last; i++) {
+            levels[level][i] = hashPair(children[2 * i], 2 * i + 1 < children.size() ? children[2 * i + 1] : 0);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef HASH_TREE_H
+#define HASH_TREE_H
+
+#include <cstdint>
+#include <vector>
+
+constexpr uint64_t HASH_BLOCK_SIZE = 4096;
+
+/**
+ * @brief Returns the 64-bit XXH64 hash of a byte range.
+ */
+uint64_t hashBytes(const char* data, uint64_t len);
+
+/**
+ * @brief Binary hash tree over the HASH_BLOCK_SIZE blocks of a storage area.
+ *
+ * Level 0 holds the hash of every block, the last one possibly short. Node i of level l + 1 hashes nodes 2i
+ * and 2i + 1 of level l, an absent right child counting as 0, so a node only depends on the blocks below it
+ * and trees over storage of different sizes agree on every node that lies fully inside both. The top level
+ * holds the single root.
+ *
+ * Updates rehash the changed blocks and their ancestors only. Not thread-safe; callers serialize access.
+ */
+class HashTree {
+   public:
+    /**
+     * @brief Builds the tree of zero-filled storage.
+     * @param size The size of the storage in bytes.
+     */
+    explicit HashTree(uint64_t size = 0);
+
+    uint32_t height() const { return static_cast<uint32_t>(levels.size()); }
+    uint64_t width(uint32_t level) const { return levels[level].size(); }
+    uint64_t node(uint32_t level, uint64_t index) const { return levels[level][index]; }
+    uint64_t root() const { return levels.back().empty() ? 0 : levels.back()[0]; }
+
+    /**
+     * @brief Rehashes blocks from their contents.
+     * @param firstBlock The first block to update.
+     * @param data The contents of the blocks, starting at the beginning of firstBlock.
+     * @param len The length of data, whole blocks except for the last block of the storage.
+     */
+    void setBlocks(uint64_t firstBlock, const char* data, uint64_t len);
+
+    /**
+     * @brief Records blocks as zero-filled.
+     */
+    void setZero(uint64_t firstBlock, uint64_t count);
+
+    /**
+     * @brief Adopts block hashes computed elsewhere, e.g. fetched from another tree over the same blocks.
+     */
+    void setHashes(uint64_t firstBlock, const uint64_t* hashes, uint64_t count);
+
+    /**
+     * @brief Returns the hash a block has when it is zero-filled.
+     */
+    uint64_t zeroHash(uint64_t block) const;
+
+    /**
+     * @brief Copies count nodes of a level starting at first into out.
+     */
+    void nodes(uint32_t level, uint64_t first, uint64_t count, uint64_t* out) const;
+
+   private:
+    uint64_t storageSize;
+    std::vector<std::vector<uint64_t>> levels;
+
+    /**
+     * @brief Recomputes the ancestors of blocks [first, last].
+     */
+    void updateParents(uint64_t first, uint64_t last);
+};
+
+#endif  // HASH_TREE_H
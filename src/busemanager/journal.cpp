@@ -0,0 +1,280 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <loguru.hpp>
+#include <system_error>
+#include <utility>
+
+#include "crc32c.hpp"
+#include "journal.hpp"
+
+namespace {
+
+constexpr uint32_t RECORD_MAGIC = 0x4c4e524a;  // "JRNL"
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t crc;  // CRC32C of the payload followed by the header with this field zero
+    uint64_t seq;  // Consecutive within a segment
+    uint64_t offset;
+    uint64_t len;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+// The payload comes first, so append() can checksum it before taking the lock that assigns the sequence number
+uint32_t recordCrc(RecordHeader header, uint32_t payloadCrc) {
+    header.crc = 0;
+    return crc32c(reinterpret_cast<const char*>(&header), sizeof(header), payloadCrc);
+}
+
+uint64_t payloadLength(uint32_t type, uint64_t len) {
+    return type == static_cast<uint32_t>(Journal::RecordType::Write) ? len : 0;
+}
+
+}  // namespace
+
+Journal::Journal(const std::string& dir) : dir(dir) {
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST)
+        throw std::system_error(errno, std::generic_category(), "mkdir " + dir);
+    DIR* listing = opendir(dir.c_str());
+    if (listing == nullptr)
+        throw std::system_error(errno, std::generic_category(), "opendir " + dir);
+    while (struct dirent* entry = readdir(listing)) {
+        unsigned long long number;
+        char suffix[16];
+        if (std::sscanf(entry->d_name, "%16llx.%15s", &number, suffix) == 2 && std::strcmp(suffix, "journal") == 0)
+            segments.push_back(Segment{number, UINT64_MAX});  // Kept until replay() tells their epoch
+    }
+    closedir(listing);
+    std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) { return a.number < b.number; });
+    replayable = segments.size();
+    openSegment(segments.empty() ? 1 : segments.back().number + 1);
+}
+
+Journal::~Journal() {
+    commit();
+    if (fd != -1)
+        close(fd);
+}
+
+std::string Journal::segmentPath(uint64_t number) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.journal", static_cast<unsigned long long>(number));
+    return dir + "/" + name;
+}
+
+void Journal::openSegment(uint64_t number) {
+    std::string path = segmentPath(number);
+    int segment = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (segment == -1)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+
+    // The new entry must survive a crash as well, or records synced into the segment would be lost with it
+    int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1 || fsync(dirFd) == -1) {
+        int err = errno;
+        if (dirFd != -1)
+            close(dirFd);
+        close(segment);
+        unlink(path.c_str());
+        throw std::system_error(err, std::generic_category(), "fsync " + dir);
+    }
+    close(dirFd);
+
+    if (fd != -1)
+        close(fd);
+    fd = segment;
+    tail = 0;
+    segments.push_back(Segment{number, 0});
+}
+
+uint64_t Journal::replay(const std::function<void(RecordType, uint64_t, const char*, uint64_t)>& apply, uint64_t epoch) {
+    std::vector<Segment> found;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        found.assign(segments.begin(), segments.begin() + static_cast<std::ptrdiff_t>(replayable));
+    }
+
+    uint64_t applied = 0;
+    std::vector<char> contents;
+    for (const Segment& segment : found) {
+        std::string path = segmentPath(segment.number);
+        int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (in == -1 || fstat(in, &st) == -1) {
+            int err = errno;
+            if (in != -1)
+                close(in);
+            throw std::system_error(err, std::generic_category(), "open " + path);
+        }
+        contents.resize(static_cast<size_t>(st.st_size));
+        size_t done = 0;
+        while (done < contents.size()) {
+            ssize_t n = pread(in, contents.data() + done, contents.size() - done, static_cast<off_t>(done));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                int err = n < 0 ? errno : EIO;
+                close(in);
+                throw std::system_error(err, std::generic_category(), "read " + path);
+            }
+            done += static_cast<size_t>(n);
+        }
+        close(in);
+
+        uint64_t pos = 0;
+        uint64_t records = 0;
+        uint64_t seq = 0;
+        while (contents.size() - pos >= sizeof(RecordHeader)) {
+            RecordHeader header;
+            std::memcpy(&header, contents.data() + pos, sizeof(header));
+            if (header.magic != RECORD_MAGIC || header.type < static_cast<uint32_t>(RecordType::Write) ||
+                header.type > static_cast<uint32_t>(RecordType::Zero))
+                break;
+            uint64_t payloadLen = payloadLength(header.type, header.len);
+            if (payloadLen > contents.size() - pos - sizeof(header) || (records != 0 && header.seq != seq + 1))
+                break;
+            const char* payload = contents.data() + pos + sizeof(header);
+            if (recordCrc(header, crc32c(payload, payloadLen)) != header.crc)
+                break;
+            apply(static_cast<RecordType>(header.type), header.offset, payloadLen != 0 ? payload : nullptr, header.len);
+            seq = header.seq;
+            records++;
+            pos += sizeof(header) + payloadLen;
+        }
+        if (pos != contents.size())
+            LOG_F(WARNING, "Journal segment %s ends in %lu bytes of torn or invalid records", path.c_str(), contents.size() - pos);
+        applied += records;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint64_t i = 0; i < replayable; i++) {
+        segments[i].maxEpoch = epoch;
+    }
+    replayable = 0;
+    return applied;
+}
+
+void Journal::append(RecordType type, uint64_t offset, const char* data, uint64_t len, uint64_t epoch) {
+    uint64_t payloadLen = payloadLength(static_cast<uint32_t>(type), len);
+    Record record{std::vector<char>(sizeof(RecordHeader) + payloadLen), epoch};
+    if (payloadLen != 0)
+        std::memcpy(record.bytes.data() + sizeof(RecordHeader), data, payloadLen);
+    uint32_t payloadCrc = crc32c(record.bytes.data() + sizeof(RecordHeader), payloadLen);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error != 0)
+        return;  // Nothing will be written anymore, and every commit reports it
+    RecordHeader header{RECORD_MAGIC, 0, ++appendedSeq, offset, len, static_cast<uint32_t>(type), 0};
+    header.crc = recordCrc(header, payloadCrc);
+    std::memcpy(record.bytes.data(), &header, sizeof(header));
+    pending.push_back(std::move(record));
+    pendingPayload += payloadLen;
+}
+
+bool Journal::commit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t target = appendedSeq;
+    while (durableSeq < target && error == 0) {
+        if (writing) {
+            committed.wait(lock);
+            continue;
+        }
+
+        writing = true;
+        if (tail >= JOURNAL_SEGMENT_SIZE) {
+            try {
+                openSegment(segments.back().number + 1);
+            } catch (const std::system_error& e) {
+                LOG_F(ERROR, "Journal rotation failed: %s", e.what());
+                error = e.code().value();
+                writing = false;
+                committed.notify_all();
+                break;
+            }
+        }
+        std::vector<Record> group = std::exchange(pending, {});
+        uint64_t groupEnd = appendedSeq;
+        pendingPayload = 0;
+        lock.unlock();
+
+        int err = writeGroup(group);
+        uint64_t groupEpoch = 0;
+        for (const auto& record : group) {
+            groupEpoch = std::max(groupEpoch, record.epoch);
+        }
+
+        lock.lock();
+        writing = false;
+        if (err != 0) {
+            LOG_F(ERROR, "Journal write failed: %s", std::strerror(err));
+            error = err;
+        } else {
+            durableSeq = groupEnd;
+            segments.back().maxEpoch = std::max(segments.back().maxEpoch, groupEpoch);
+        }
+        committed.notify_all();
+    }
+    return durableSeq >= target;
+}
+
+int Journal::writeGroup(std::vector<Record>& group) {
+    std::vector<struct iovec> iov;
+    iov.reserve(group.size());
+    for (auto& record : group) {
+        iov.push_back(iovec{record.bytes.data(), record.bytes.size()});
+    }
+
+    size_t next = 0;
+    while (next < iov.size()) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - next, IOV_MAX));
+        ssize_t n = pwritev(fd, iov.data() + next, count, static_cast<off_t>(tail));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        tail += static_cast<uint64_t>(n);
+        while (next < iov.size() && static_cast<size_t>(n) >= iov[next].iov_len) {
+            n -= static_cast<ssize_t>(iov[next].iov_len);
+            next++;
+        }
+        if (next < iov.size()) {
+            iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + n;
+            iov[next].iov_len -= static_cast<size_t>(n);
+        }
+    }
+    if (fdatasync(fd) == -1)
+        return errno;
+    return 0;
+}
+
+uint64_t Journal::pendingBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pendingPayload;
+}
+
+bool Journal::canRetire(uint64_t durableEpoch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return replayable == 0 && segments.size() > 1 && segments.front().maxEpoch <= durableEpoch;
+}
+
+void Journal::retire(uint64_t durableEpoch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (replayable == 0 && segments.size() > 1 && segments.front().maxEpoch <= durableEpoch) {
+        std::string path = segmentPath(segments.front().number);
+        if (unlink(path.c_str()) == -1 && errno != ENOENT) {
+            LOG_F(ERROR, "Failed to delete journal segment %s: %s", path.c_str(), std::strerror(errno));
+            return;
+        }
+        segments.pop_front();
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+constexpr uint64_t JOURNAL_SEGMENT_SIZE = 64 * 1024 * 1024;  // Size at which the journal moves on to a new segment
+
+/**
+ * @brief Append-only log of device modifications, kept in a directory of numbered segment files.
+ *
+ * Records are appended to a queue in the order they are applied to the buffer. commit() writes the queue to
+ * the end of the active segment with pwritev and makes it durable with one fdatasync, so concurrent callers
+ * share a single write and sync (group commit) and the disk only sees sequential appends. Each record carries
+ * a CRC32C over its header and payload, so a record torn by a crash ends the replay of its segment.
+ *
+ * Every record is tagged with the epoch of the synchronization round that will upload it. The active segment
+ * is replaced once it exceeds the segment size, and retire() deletes the oldest segments once every record in
+ * them is durable on the remote store. Only a prefix of the segments is ever deleted, so replaying what is
+ * left never brings back data older than what the remote store already holds.
+ *
+ * If a write or sync fails, the journal stops accepting records and every later commit fails, as the kernel
+ * may have dropped the data it could not write back.
+ */
+class Journal {
+   public:
+    enum class RecordType : uint32_t {
+        Write = 1,  // Payload holds the new data of the range
+        Trim = 2,   // Whole blocks of the range were discarded; no payload
+        Zero = 3,   // Whole blocks of the range were zeroed in place, staying allocated; no payload
+    };
+
+    /**
+     * @brief Opens the journal directory, creating it if it does not exist.
+     * @param dir The directory holding the segments.
+     * @throws std::system_error if the directory or the new active segment cannot be created.
+     *
+     * Existing segments are kept for replay(); records are appended to a new segment after them.
+     */
+    explicit Journal(const std::string& dir);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /**
+     * @brief Applies the records of the segments found at startup, oldest first.
+     * @param apply Called with the type, offset, payload and length of each record; the payload is null for
+     * a trim.
+     * @param epoch The epoch the applied modifications are uploaded in, which the replayed segments retire by.
+     * @return The number of records applied.
+     * @throws std::system_error if a segment cannot be read.
+     */
+    uint64_t replay(const std::function<void(RecordType, uint64_t, const char*, uint64_t)>& apply, uint64_t epoch);
+
+    /**
+     * @brief Queues a record for the next commit.
+     * @param type The kind of modification.
+     * @param offset The starting offset of the modified range.
+     * @param data The new contents of the range for a write, null for a trim.
+     * @param len The length of the range.
+     * @param epoch The epoch of the round that will upload the modification.
+     *
+     * The payload is copied, so the caller may modify the range right after. Must be called while the range
+     * is still locked exclusively, which keeps the records of overlapping modifications in order.
+     */
+    void append(RecordType type, uint64_t offset, const char* data, uint64_t len, uint64_t epoch);
+
+    /**
+     * @brief Makes every record appended so far durable.
+     * @return false if the journal failed to write or sync them.
+     *
+     * The first caller to find no commit in progress writes out the whole queue; callers arriving meanwhile
+     * wait for it and then commit whatever was queued behind it as the next group.
+     */
+    bool commit();
+
+    /**
+     * @brief Returns the payload bytes queued and not yet written.
+     */
+    uint64_t pendingBytes();
+
+    /**
+     * @brief Returns whether retire() would delete any segment for the given durable epoch.
+     */
+    bool canRetire(uint64_t durableEpoch);
+
+    /**
+     * @brief Deletes the oldest segments whose records are all durable on the remote store.
+     * @param durableEpoch The latest epoch whose round made its snapshot durable.
+     *
+     * The active segment is never deleted.
+     */
+    void retire(uint64_t durableEpoch);
+
+   private:
+    struct Segment {
+        uint64_t number;
+        uint64_t maxEpoch;  // Latest epoch of a record written to the segment
+    };
+
+    struct Record {
+        std::vector<char> bytes;  // Header followed by the payload
+        uint64_t epoch;
+    };
+
+    std::string dir;
+    std::mutex mutex;  // Guards everything below except the file of the active segment
+    std::condition_variable committed;
+    std::deque<Segment> segments;  // Oldest first; the last one is active
+    uint64_t replayable = 0;       // Segments at the front found at startup
+    std::vector<Record> pending;
+    uint64_t pendingPayload = 0;
+    uint64_t appendedSeq = 0;  // Sequence number of the last record appended
+    uint64_t durableSeq = 0;   // Sequence number of the last record made durable
+    bool writing = false;      // Whether a commit is writing a group, which owns fd and tail meanwhile
+    int error = 0;
+    int fd = -1;  // Active segment
+    uint64_t tail = 0;
+
+    std::string segmentPath(uint64_t number) const;
+
+    /**
+     * @brief Creates the next segment and makes it active. Must be called with mutex held and no group in flight.
+     * @throws std::system_error if the segment cannot be created.
+     */
+    void openSegment(uint64_t number);
+
+    /**
+     * @brief Writes records at the tail of the active segment and syncs them.
+     * @return 0 or the errno of the failed call.
+     */
+    int writeGroup(std::vector<Record>& group);
+};
+
+#endif  // JOURNAL_H
@@ -0,0 +1,137 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include "mappedbuffer.hpp"
+
+MappedBuffer::~MappedBuffer() {
+    release();
+}
+
+MappedBuffer::MappedBuffer(MappedBuffer&& other) noexcept
+    : data(std::exchange(other.data, nullptr)), length(std::exchange(other.length, 0)), fd(std::exchange(other.fd, -1)) {}
+
+MappedBuffer& MappedBuffer::operator=(MappedBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        data = std::exchange(other.data, nullptr);
+        length = std::exchange(other.length, 0);
+        fd = std::exchange(other.fd, -1);
+    }
+    return *this;
+}
+
+void MappedBuffer::release() {
+    if (data != nullptr)
+        munmap(data, length);
+    if (fd != -1)
+        close(fd);
+    data = nullptr;
+    length = 0;
+    fd = -1;
+}
+
+MappedBuffer MappedBuffer::anonymous(uint64_t size) {
+    MappedBuffer mapping;
+    if (size == 0)
+        return mapping;
+
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "mmap");
+
+    mapping.data = static_cast<char*>(addr);
+    mapping.length = size;
+    return mapping;
+}
+
+MappedBuffer MappedBuffer::file(const std::string& path, uint64_t size) {
+    MappedBuffer mapping;
+
+    mapping.fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (mapping.fd == -1)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+
+    struct stat st;
+    if (fstat(mapping.fd, &st) == -1)
+        throw std::system_error(errno, std::generic_category(), "fstat " + path);
+
+    if (size == 0)
+        size = static_cast<uint64_t>(st.st_size);
+    if (size == 0)
+        throw std::system_error(EINVAL, std::generic_category(), "empty image " + path);
+
+    // Growing with ftruncate leaves a hole, so no blocks are allocated until written
+    if (static_cast<uint64_t>(st.st_size) < size && ftruncate(mapping.fd, static_cast<off_t>(size)) == -1)
+        throw std::system_error(errno, std::generic_category(), "ftruncate " + path);
+
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mapping.fd, 0);
+    if (addr == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "mmap " + path);
+
+    mapping.data = static_cast<char*>(addr);
+    mapping.length = size;
+    return mapping;
+}
+
+void MappedBuffer::discard(uint64_t offset, uint64_t len) {
+    const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t first = (offset + pageSize - 1) / pageSize * pageSize;
+    uint64_t last = (offset + len) / pageSize * pageSize;
+    if (first >= last) {
+        std::memset(data + offset, 0, len);
+        return;
+    }
+    std::memset(data + offset, 0, first - offset);
+    std::memset(data + last, 0, offset + len - last);
+
+    if (fd != -1) {
+        // Punching the hole also drops the shared pages, so the mapping reads zeros right away
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(first), static_cast<off_t>(last - first)) == 0)
+            return;
+        if (errno != EOPNOTSUPP)
+            throw std::system_error(errno, std::generic_category(), "fallocate");
+        std::memset(data + first, 0, last - first);  // File system without hole punching
+        return;
+    }
+    if (madvise(data + first, last - first, MADV_DONTNEED) == -1)
+        throw std::system_error(errno, std::generic_category(), "madvise");
+}
+
+void MappedBuffer::prefetch(uint64_t offset, uint64_t len) const {
+    const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t first = offset / pageSize * pageSize;
+    madvise(data + first, offset + len - first, MADV_WILLNEED);  // Only a hint, so failures are of no concern
+}
+
+void MappedBuffer::sync() const {
+    if (fd != -1 && msync(data, length, MS_SYNC) == -1)
+        throw std::system_error(errno, std::generic_category(), "msync");
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> MappedBuffer::dataExtents() const {
+    std::vector<std::pair<uint64_t, uint64_t>> extents;
+    if (fd == -1) {
+        if (length != 0)
+            extents.emplace_back(0, length);
+        return extents;
+    }
+
+    off_t end = static_cast<off_t>(length);
+    off_t offset = 0;
+    while (offset < end) {
+        off_t dataStart = lseek(fd, offset, SEEK_DATA);
+        if (dataStart == -1 || dataStart >= end)
+            break;  // ENXIO: no data past offset
+        off_t dataEnd = lseek(fd, dataStart, SEEK_HOLE);
+        if (dataEnd == -1 || dataEnd > end)
+            dataEnd = end;
+        extents.emplace_back(static_cast<uint64_t>(dataStart), static_cast<uint64_t>(dataEnd - dataStart));
+        offset = dataEnd;
+    }
+    return extents;
+}
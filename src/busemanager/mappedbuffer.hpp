@@ -0,0 +1,91 @@
+#ifndef MAPPED_BUFFER_H
+#define MAPPED_BUFFER_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Memory mapping holding a device image, either anonymous or backed by a sparse file.
+ *
+ * Pages are only committed when first touched, so creating a mapping is instant regardless of its size and
+ * untouched regions consume no memory. File-backed mappings are shared with the page cache, which handles
+ * eviction and keeps the image across process restarts.
+ */
+class MappedBuffer {
+   public:
+    MappedBuffer() = default;
+    ~MappedBuffer();
+
+    MappedBuffer(MappedBuffer&& other) noexcept;
+    MappedBuffer& operator=(MappedBuffer&& other) noexcept;
+    MappedBuffer(const MappedBuffer&) = delete;
+    MappedBuffer& operator=(const MappedBuffer&) = delete;
+
+    /**
+     * @brief Maps zero-filled anonymous memory.
+     * @param size The size of the mapping in bytes.
+     * @return The mapping.
+     * @throws std::system_error if the mapping fails.
+     */
+    static MappedBuffer anonymous(uint64_t size);
+
+    /**
+     * @brief Maps an image file, creating it as a sparse file if it does not exist.
+     * @param path The path of the image file.
+     * @param size The size of the image in bytes, or 0 to use the size of an existing file.
+     * @return The mapping.
+     * @throws std::system_error if the file cannot be opened, resized or mapped.
+     */
+    static MappedBuffer file(const std::string& path, uint64_t size);
+
+    char* get() const { return data; }
+    char& operator[](uint64_t i) const { return data[i]; }
+    uint64_t size() const { return length; }
+    bool isFileBacked() const { return fd != -1; }
+
+    /**
+     * @brief Zeroes a byte range and releases the memory or file blocks backing it.
+     * @param offset The start of the range.
+     * @param len The length of the range.
+     * @throws std::system_error if the pages cannot be released.
+     *
+     * Whole pages are dropped with MADV_DONTNEED for anonymous memory and punched out of the image file
+     * otherwise, so they read back as zeros and take no space until written again. Partial pages at the
+     * edges are cleared in place.
+     */
+    void discard(uint64_t offset, uint64_t len);
+
+    /**
+     * @brief Asks the kernel to start reading a byte range of the image file into the page cache.
+     * @param offset The start of the range.
+     * @param len The length of the range.
+     *
+     * Returns without waiting for the reads, which MADV_WILLNEED issues asynchronously.
+     */
+    void prefetch(uint64_t offset, uint64_t len) const;
+
+    /**
+     * @brief Writes the modified pages of an image file back and waits for them to be durable.
+     * @throws std::system_error if the write-back fails.
+     *
+     * Does nothing for anonymous memory.
+     */
+    void sync() const;
+
+    /**
+     * @brief Returns the byte ranges of the image file that hold data, skipping holes.
+     * @return Pairs of start offset and length, the whole mapping for anonymous memory.
+     */
+    std::vector<std::pair<uint64_t, uint64_t>> dataExtents() const;
+
+   private:
+    char* data = nullptr;
+    uint64_t length = 0;
+    int fd = -1;
+
+    void release();
+};
+
+#endif  // MAPPED_BUFFER_H
@@ -0,0 +1,67 @@
+#include <sys/mman.h>
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+#include "memoryremotestore.hpp"
+
+MemoryRemoteStore::MemoryRemoteStore(MappedBuffer storage) : storage(std::move(storage)), tree(this->storage.size()) {
+    if (this->storage.isFileBacked()) {
+        for (const auto& [offset, len] : this->storage.dataExtents()) {
+            rehash(offset, len);
+        }
+    }
+}
+
+void MemoryRemoteStore::checkRange(uint64_t offset, uint64_t len) const {
+    if (len > storage.size() || offset > storage.size() - len)
+        throw std::system_error(EINVAL, std::generic_category(), "remote range out of bounds");
+}
+
+void MemoryRemoteStore::rehash(uint64_t offset, uint64_t len) {
+    if (len == 0)
+        return;
+    uint64_t start = offset / HASH_BLOCK_SIZE * HASH_BLOCK_SIZE;
+    uint64_t end = std::min((offset + len + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE * HASH_BLOCK_SIZE, storage.size());
+    tree.setBlocks(start / HASH_BLOCK_SIZE, storage.get() + start, end - start);
+}
+
+void MemoryRemoteStore::put(uint64_t offset, const char* data, uint32_t len) {
+    checkRange(offset, len);
+    std::lock_guard<std::mutex> lock(treeMutex);
+    std::memcpy(storage.get() + offset, data, len);
+    rehash(offset, len);
+}
+
+void MemoryRemoteStore::zero(uint64_t offset, uint64_t len) {
+    checkRange(offset, len);
+    std::lock_guard<std::mutex> lock(treeMutex);
+    storage.discard(offset, len);
+    uint64_t firstBlock = (offset + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE;
+    uint64_t endBlock = offset + len == storage.size() ? tree.width(0) : (offset + len) / HASH_BLOCK_SIZE;
+    if (firstBlock < endBlock) {
+        tree.setZero(firstBlock, endBlock - firstBlock);
+        rehash(offset, firstBlock * HASH_BLOCK_SIZE - offset);
+        rehash(std::min(endBlock * HASH_BLOCK_SIZE, offset + len), offset + len - std::min(endBlock * HASH_BLOCK_SIZE, offset + len));
+    } else {
+        rehash(offset, len);
+    }
+}
+
+void MemoryRemoteStore::get(uint64_t offset, char* data, uint32_t len) {
+    checkRange(offset, len);
+    std::memcpy(data, storage.get() + offset, len);
+}
+
+void MemoryRemoteStore::hashes(uint32_t level, uint64_t first, uint64_t count, uint64_t* out) {
+    std::lock_guard<std::mutex> lock(treeMutex);
+    if (level >= tree.height() || first > tree.width(level) || count > tree.width(level) - first)
+        throw std::system_error(EINVAL, std::generic_category(), "hash nodes out of bounds");
+    tree.nodes(level, first, count, out);
+}
+
+void MemoryRemoteStore::flush() {
+    if (storage.isFileBacked() && msync(storage.get(), storage.size(), MS_SYNC) == -1)
+        throw std::system_error(errno, std::generic_category(), "msync");
+}
@@ -0,0 +1,40 @@
+#ifndef MEMORY_REMOTE_STORE_H
+#define MEMORY_REMOTE_STORE_H
+
+#include <mutex>
+
+#include "hashtree.hpp"
+#include "mappedbuffer.hpp"
+#include "remotestore.hpp"
+
+/**
+ * @brief Remote store kept in a local mapping, used in-process and as the storage of the remote server.
+ *
+ * Keeps a HashTree of the storage up to date with every put and zero, hashing the data of an existing image
+ * once at startup.
+ */
+class MemoryRemoteStore : public RemoteStore {
+   public:
+    explicit MemoryRemoteStore(MappedBuffer storage);
+
+    uint64_t size() const override { return storage.size(); }
+    void put(uint64_t offset, const char* data, uint32_t len) override;
+    void zero(uint64_t offset, uint64_t len) override;
+    void get(uint64_t offset, char* data, uint32_t len) override;
+    void flush() override;
+    void hashes(uint32_t level, uint64_t first, uint64_t count, uint64_t* out) override;
+
+   private:
+    MappedBuffer storage;
+    HashTree tree;
+    std::mutex treeMutex;  // Guards tree and orders updates of a block with its rehash
+
+    void checkRange(uint64_t offset, uint64_t len) const;
+
+    /**
+     * @brief Rehashes the blocks covering a byte range from the storage. Must be called with treeMutex held.
+     */
+    void rehash(uint64_t offset, uint64_t len);
+};
+
+#endif  // MEMORY_REMOTE_STORE_H
@@ -0,0 +1,66 @@
+#ifndef REMOTE_PROTOCOL_H
+#define REMOTE_PROTOCOL_H
+
+#include <endian.h>
+#include <cstdint>
+
+/*
+ * Wire format between TcpRemoteStore and buse_remote. Every request is answered by one reply, in order.
+ * Put requests are followed by len payload bytes, replies to Get by len data bytes when error is 0, with the
+ * CRC32C of the data in the reply value.
+ * PutBatch requests carry offset extent descriptors followed by the len payload bytes of all extents, in order.
+ * Each descriptor holds the CRC32C of its payload; the server rejects a batch whose payload does not match with
+ * EBADMSG, before storing that extent.
+ * Zero requests carry no payload and clear len bytes at offset.
+ * Hash requests ask for len nodes of the server's hash tree, starting at node offset & REMOTE_HASH_INDEX_MASK of
+ * level offset >> REMOTE_HASH_LEVEL_SHIFT; replies carry len 8-byte node hashes when error is 0.
+ * All fields are big-endian.
+ */
+
+constexpr uint32_t REMOTE_REQUEST_MAGIC = 0x62726d71;  // "brmq"
+constexpr uint32_t REMOTE_REPLY_MAGIC = 0x62726d70;    // "brmp"
+
+enum class RemoteCommand : uint32_t {
+    Size = 0,  // reply value holds the storage size
+    Put = 1,
+    Get = 2,
+    Flush = 3,
+    PutBatch = 4,
+    Zero = 5,
+    Hash = 6,
+};
+
+constexpr uint32_t REMOTE_HASH_LEVEL_SHIFT = 56;
+constexpr uint64_t REMOTE_HASH_INDEX_MASK = (uint64_t{1} << REMOTE_HASH_LEVEL_SHIFT) - 1;
+constexpr uint32_t REMOTE_MAX_HASH_NODES = 64 * 1024;  // Per Hash request
+constexpr uint64_t REMOTE_MAX_BATCH_EXTENTS = 1022;    // Per PutBatch, so request, descriptors and payloads fit IOV_MAX
+constexpr uint32_t REMOTE_MAX_PAYLOAD = 64 * 1024 * 1024;  // Largest payload of one request
+
+struct __attribute__((packed)) RemoteRequest {
+    uint32_t magic;
+    uint32_t command;
+    uint64_t offset;
+    uint32_t len;
+};
+
+struct __attribute__((packed)) RemoteExtentHeader {
+    uint64_t offset;
+    uint32_t len;
+    uint32_t crc;
+};
+
+struct __attribute__((packed)) RemoteReply {
+    uint32_t magic;
+    uint32_t error;  // 0 or an errno value
+    uint64_t value;
+};
+
+inline RemoteRequest makeRemoteRequest(RemoteCommand command, uint64_t offset, uint32_t len) {
+    return RemoteRequest{htobe32(REMOTE_REQUEST_MAGIC), htobe32(static_cast<uint32_t>(command)), htobe64(offset), htobe32(len)};
+}
+
+inline RemoteReply makeRemoteReply(uint32_t error, uint64_t value = 0) {
+    return RemoteReply{htobe32(REMOTE_REPLY_MAGIC), htobe32(error), htobe64(value)};
+}
+
+#endif  // REMOTE_PROTOCOL_H
@@ -0,0 +1,104 @@
+#ifndef REMOTE_STORE_H
+#define REMOTE_STORE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief A range of bytes to store remotely.
+ */
+struct RemoteExtent {
+    uint64_t offset;
+    const char* data;
+    uint32_t len;
+};
+
+/**
+ * @brief Block storage the local buffer is synchronized to.
+ *
+ * Implementations must be safe to call from several threads. Failures are reported by throwing
+ * std::system_error or std::runtime_error; the caller keeps the affected ranges dirty and retries later.
+ */
+class RemoteStore {
+   public:
+    virtual ~RemoteStore() = default;
+
+    /**
+     * @brief Returns the size of the remote storage in bytes.
+     * @return The size of the remote storage.
+     */
+    virtual uint64_t size() const = 0;
+
+    /**
+     * @brief Stores a range of bytes.
+     * @param offset The offset of the range.
+     * @param data The bytes to store.
+     * @param len The length of the range.
+     */
+    virtual void put(uint64_t offset, const char* data, uint32_t len) = 0;
+
+    /**
+     * @brief Stores many ranges, grouping them into batches of up to batchBytes and keeping up to window
+     * batches in flight.
+     * @param extents The ranges to store.
+     * @param count The number of ranges.
+     * @param batchBytes The payload size at which a batch is closed.
+     * @param window The number of batches that may be outstanding at once.
+     *
+     * Transports with a per-request round trip override this to pipeline; the default stores one range at a time.
+     */
+    virtual void putMany(const RemoteExtent* extents, size_t count, uint32_t batchBytes, size_t window) {
+        (void)batchBytes;
+        (void)window;
+        for (size_t i = 0; i < count; i++) {
+            put(extents[i].offset, extents[i].data, extents[i].len);
+        }
+    }
+
+    /**
+     * @brief Clears a range of bytes to zero, without shipping the zeros.
+     * @param offset The offset of the range.
+     * @param len The length of the range.
+     *
+     * Stores that can release the space override this; the default stores zero-filled buffers.
+     */
+    virtual void zero(uint64_t offset, uint64_t len) {
+        constexpr uint32_t ZERO_CHUNK = 1024 * 1024;
+        std::vector<char> zeros(static_cast<size_t>(std::min<uint64_t>(len, ZERO_CHUNK)));
+        while (len > 0) {
+            uint32_t chunk = static_cast<uint32_t>(std::min<uint64_t>(len, ZERO_CHUNK));
+            put(offset, zeros.data(), chunk);
+            offset += chunk;
+            len -= chunk;
+        }
+    }
+
+    /**
+     * @brief Fetches a range of bytes.
+     * @param offset The offset of the range.
+     * @param data The destination of the bytes.
+     * @param len The length of the range.
+     */
+    virtual void get(uint64_t offset, char* data, uint32_t len) = 0;
+
+    /**
+     * @brief Makes every range stored so far durable on the remote side.
+     */
+    virtual void flush() = 0;
+
+    /**
+     * @brief Fetches node hashes of the HashTree over the remote storage.
+     * @param level The tree level, 0 for the block hashes.
+     * @param first The index of the first node.
+     * @param count The number of nodes.
+     * @param out Receives count hashes.
+     *
+     * Lets a client compare its view of the storage against the remote one subtree by subtree instead of
+     * reading the data back.
+     */
+    virtual void hashes(uint32_t level, uint64_t first, uint64_t count, uint64_t* out) = 0;
+};
+
+#endif  // REMOTE_STORE_H
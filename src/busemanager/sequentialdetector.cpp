@@ -0,0 +1,46 @@
+#include <algorithm>
+
+#include "sequentialdetector.hpp"
+
+SequentialDetector::SequentialDetector(uint64_t minWindow, uint64_t maxWindow, size_t streams, size_t shards)
+    : minWindow(minWindow), maxWindow(std::max(minWindow, maxWindow)), shardCount(std::max<size_t>(shards, 1)),
+      shards(std::make_unique<Shard[]>(shardCount)) {
+    for (size_t i = 0; i < shardCount; i++) {
+        this->shards[i].streams.resize(std::max<size_t>(streams, 1));
+    }
+}
+
+ReadaheadRange SequentialDetector::access(uint64_t offset, uint64_t len) {
+    Shard& shard = shards[offset / DETECTOR_REGION_SIZE % shardCount];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint64_t clock = ++shard.clock;
+    uint64_t end = offset + len;
+
+    Stream* match = nullptr;
+    Stream* oldest = &shard.streams[0];
+    for (auto& stream : shard.streams) {
+        if (stream.lastUse != 0 && offset + stream.window >= stream.next && offset <= stream.next + stream.window) {
+            match = &stream;
+            break;
+        }
+        if (stream.lastUse < oldest->lastUse)
+            oldest = &stream;
+    }
+
+    if (match == nullptr) {
+        *oldest = Stream{end, end, end, minWindow, clock};
+        return {0, 0};
+    }
+
+    Stream& stream = *match;
+    stream.lastUse = clock;
+    stream.next = std::max(stream.next, end);
+    if (stream.next < stream.topUp)
+        return {0, 0};
+
+    uint64_t start = std::max(stream.ahead, stream.next);
+    stream.ahead = stream.next + stream.window;
+    stream.topUp = stream.next + stream.window / 2;
+    stream.window = std::min(stream.window * 2, maxWindow);
+    return {start, stream.ahead - start};
+}
@@ -0,0 +1,73 @@
+#ifndef SEQUENTIAL_DETECTOR_H
+#define SEQUENTIAL_DETECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+constexpr uint64_t DETECTOR_REGION_SIZE = 1ULL << 30;  // Span of the device whose streams share a shard
+
+/**
+ * @brief A byte range to read ahead, empty when len is 0.
+ */
+struct ReadaheadRange {
+    uint64_t offset;
+    uint64_t len;
+};
+
+/**
+ * @brief Recognizes sequential read streams and decides how far ahead of each to read.
+ *
+ * Streams are tracked per DETECTOR_REGION_SIZE region of the device, spread over shards with a lock of their
+ * own, so reads of different regions do not contend. Each shard tracks up to a fixed number of streams; a read
+ * that continues none of its region's streams starts a new one in place of the shard's least recently used. A
+ * read continues a stream when it starts within one window of where the stream's last read ended, which
+ * tolerates the small reorderings of requests served by several threads.
+ *
+ * Once a stream has been continued, readahead covers one window past its position and is topped up whenever
+ * less than half a window is left ahead of it. The window starts at minWindow and doubles with every top-up up
+ * to maxWindow, so short runs cost little and long scans quickly reach full bandwidth. A stream crossing into
+ * the next region starts over there with the smallest window. Safe to call from any number of threads.
+ */
+class SequentialDetector {
+   public:
+    /**
+     * @param minWindow The readahead window of a newly detected stream.
+     * @param maxWindow The largest the window grows to.
+     * @param streams The number of streams tracked at once by each shard.
+     * @param shards The number of independently locked shards.
+     */
+    SequentialDetector(uint64_t minWindow, uint64_t maxWindow, size_t streams = 16, size_t shards = 16);
+
+    /**
+     * @brief Records a read and returns the range to read ahead because of it, if any.
+     * @param offset The starting offset of the read.
+     * @param len The length of the read.
+     * @return The range not read ahead yet that the stream of the read now needs.
+     */
+    ReadaheadRange access(uint64_t offset, uint64_t len);
+
+   private:
+    struct Stream {
+        uint64_t next = 0;      // Where the stream's reads have reached
+        uint64_t ahead = 0;     // Where readahead has reached
+        uint64_t topUp = 0;     // Where the stream's reads trigger the next readahead
+        uint64_t window = 0;
+        uint64_t lastUse = 0;   // 0 for an unused slot
+    };
+
+    struct Shard {
+        std::mutex mutex;  // Guards streams and clock
+        std::vector<Stream> streams;
+        uint64_t clock = 0;
+    };
+
+    const uint64_t minWindow;
+    const uint64_t maxWindow;
+    const size_t shardCount;
+    std::unique_ptr<Shard[]> shards;
+};
+
+#endif  // SEQUENTIAL_DETECTOR_H
@@ -0,0 +1,42 @@
+#ifndef SOCKET_IO_H
+#define SOCKET_IO_H
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Writes the whole buffer, retrying short writes.
+ * @throws std::system_error on failure.
+ */
+void sendAll(int fd, const void* buf, size_t len);
+
+/**
+ * @brief Writes every iovec in order, retrying short writes. The iovec array is modified.
+ * @throws std::system_error on failure.
+ */
+void sendvAll(int fd, struct iovec* iov, int iovcnt);
+
+/**
+ * @brief Reads exactly len bytes.
+ * @return false if the peer closed the connection before the first byte.
+ * @throws std::system_error on failure or if the connection is closed in the middle of the buffer.
+ */
+bool recvAll(int fd, void* buf, size_t len);
+
+/**
+ * @brief Connects to a TCP endpoint given as host:port.
+ * @return The connected socket, with Nagle's algorithm disabled.
+ * @throws std::system_error on failure.
+ */
+int connectTcp(const std::string& endpoint);
+
+/**
+ * @brief Opens a TCP socket listening on all interfaces.
+ * @return The listening socket.
+ * @throws std::system_error on failure.
+ */
+int listenTcp(uint16_t port);
+
+#endif  // SOCKET_IO_H
@@ -0,0 +1,99 @@
+#ifndef STRIPED_LOCK_H
+#define STRIPED_LOCK_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+
+/**
+ * @brief Reader/writer locks over byte ranges of the device, striped by region.
+ *
+ * The device is divided into REGION_SIZE regions, each hashed onto one of STRIPES shared mutexes. Locking a
+ * range takes every stripe it touches in ascending order, so I/O on unrelated regions proceeds in parallel and
+ * overlapping requests can never deadlock. Reads take stripes shared, writes exclusive.
+ */
+class StripedLock {
+   public:
+    static constexpr uint64_t REGION_SIZE = 64 * 1024;
+    static constexpr size_t STRIPES = 1024;
+
+    void lock(uint64_t offset, uint64_t len) {
+        forEachStripe(offset, len, [](std::shared_mutex& m) { m.lock(); });
+    }
+    void unlock(uint64_t offset, uint64_t len) {
+        forEachStripe(offset, len, [](std::shared_mutex& m) { m.unlock(); });
+    }
+    void lockShared(uint64_t offset, uint64_t len) {
+        forEachStripe(offset, len, [](std::shared_mutex& m) { m.lock_shared(); });
+    }
+    void unlockShared(uint64_t offset, uint64_t len) {
+        forEachStripe(offset, len, [](std::shared_mutex& m) { m.unlock_shared(); });
+    }
+
+   private:
+    static constexpr size_t MAX_LISTED = 64;  // Larger ranges simply take every stripe
+    std::array<std::shared_mutex, STRIPES> stripes;
+
+    template <typename Fn>
+    void forEachStripe(uint64_t offset, uint64_t len, Fn&& fn) {
+        uint64_t firstRegion = offset / REGION_SIZE;
+        uint64_t lastRegion = (offset + (len ? len : 1) - 1) / REGION_SIZE;
+        uint64_t regions = lastRegion - firstRegion + 1;
+
+        if (regions > MAX_LISTED) {
+            for (auto& m : stripes)
+                fn(m);
+            return;
+        }
+
+        // Sorted, deduplicated stripe indices; an insertion sort is plenty for a handful of entries
+        size_t indices[MAX_LISTED];
+        size_t count = 0;
+        for (uint64_t region = firstRegion; region <= lastRegion; region++) {
+            size_t index = region % STRIPES;
+            size_t pos = count;
+            while (pos > 0 && indices[pos - 1] > index)
+                pos--;
+            if (pos > 0 && indices[pos - 1] == index)
+                continue;
+            for (size_t i = count; i > pos; i--)
+                indices[i] = indices[i - 1];
+            indices[pos] = index;
+            count++;
+        }
+        for (size_t i = 0; i < count; i++)
+            fn(stripes[indices[i]]);
+    }
+};
+
+/**
+ * @brief Holds a range of a StripedLock for the lifetime of the guard.
+ */
+class RangeGuard {
+   public:
+    RangeGuard(StripedLock& locks, uint64_t offset, uint64_t len, bool exclusive)
+        : locks(locks), offset(offset), len(len), exclusive(exclusive) {
+        if (exclusive)
+            locks.lock(offset, len);
+        else
+            locks.lockShared(offset, len);
+    }
+    ~RangeGuard() {
+        if (exclusive)
+            locks.unlock(offset, len);
+        else
+            locks.unlockShared(offset, len);
+    }
+
+    RangeGuard(const RangeGuard&) = delete;
+    RangeGuard& operator=(const RangeGuard&) = delete;
+
+   private:
+    StripedLock& locks;
+    uint64_t offset;
+    uint64_t len;
+    bool exclusive;
+};
+
+#endif  // STRIPED_LOCK_H
@@ -0,0 +1,202 @@
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "crc32c.hpp"
+#include "remoteprotocol.hpp"
+#include "socketio.hpp"
+#include "tcpremotestore.hpp"
+
+TcpRemoteStore::TcpRemoteStore(const std::string& endpoint) : endpoint(endpoint) {
+    std::lock_guard<std::mutex> lock(sockMutex);
+    ensureConnected();
+}
+
+TcpRemoteStore::~TcpRemoteStore() {
+    disconnect();
+}
+
+void TcpRemoteStore::ensureConnected() {
+    if (sock != -1)
+        return;
+    sock = connectTcp(endpoint);
+    try {
+        RemoteRequest request = makeRemoteRequest(RemoteCommand::Size, 0, 0);
+        send(&request, sizeof(request));
+        uint64_t size = readReply("size");
+        if (remoteSize != 0 && size != remoteSize)
+            throw std::system_error(EPROTO, std::generic_category(), "remote changed size across reconnect");
+        remoteSize = size;
+    } catch (...) {
+        disconnect();
+        throw;
+    }
+}
+
+void TcpRemoteStore::disconnect() {
+    if (sock != -1)
+        close(sock);
+    sock = -1;
+}
+
+void TcpRemoteStore::send(struct iovec* iov, int iovcnt) {
+    try {
+        sendvAll(sock, iov, iovcnt);
+    } catch (...) {
+        disconnect();  // Part of the request may have gone out
+        throw;
+    }
+}
+
+void TcpRemoteStore::send(const void* buf, size_t len) {
+    struct iovec iov = {const_cast<void*>(buf), len};
+    send(&iov, 1);
+}
+
+void TcpRemoteStore::receive(void* buf, size_t len, const char* what) {
+    try {
+        if (!recvAll(sock, buf, len))
+            throw std::system_error(ECONNRESET, std::generic_category(), std::string("remote closed connection during ") + what);
+    } catch (...) {
+        disconnect();
+        throw;
+    }
+}
+
+uint64_t TcpRemoteStore::readReply(const char* what, int* error) {
+    RemoteReply reply;
+    receive(&reply, sizeof(reply), what);
+    if (be32toh(reply.magic) != REMOTE_REPLY_MAGIC) {
+        disconnect();
+        throw std::system_error(EPROTO, std::generic_category(), std::string("bad reply magic for ") + what);
+    }
+    if (reply.error != 0) {
+        int code = static_cast<int>(be32toh(reply.error));
+        if (error == nullptr)
+            throw std::system_error(code, std::generic_category(), std::string("remote ") + what);
+        *error = code;
+        return 0;
+    }
+    return be64toh(reply.value);
+}
+
+void TcpRemoteStore::put(uint64_t offset, const char* data, uint32_t len) {
+    // Sent as a batch of one, so the payload is checksummed like every other upload
+    RemoteExtent extent{offset, data, len};
+    putMany(&extent, 1, len, 1);
+}
+
+void TcpRemoteStore::putMany(const RemoteExtent* extents, size_t count, uint32_t batchBytes, size_t window) {
+    std::lock_guard<std::mutex> lock(sockMutex);
+    ensureConnected();
+    std::vector<RemoteExtentHeader> headers;
+    std::vector<struct iovec> iov;
+    size_t outstanding = 0;
+    int error = 0;  // First error reply; no further batches are sent after it
+
+    // Replies are tiny, so a bounded window of them always fits in the socket buffers while we keep sending
+    size_t i = 0;
+    while (i < count && error == 0) {
+        size_t first = i;
+        uint64_t payload = 0;
+        while (i < count && (i == first || (payload + extents[i].len <= batchBytes && i - first < REMOTE_MAX_BATCH_EXTENTS))) {
+            payload += extents[i].len;
+            i++;
+        }
+
+        headers.resize(i - first);
+        iov.resize(2 + (i - first));
+        RemoteRequest request = makeRemoteRequest(RemoteCommand::PutBatch, i - first, static_cast<uint32_t>(payload));
+        iov[0] = {&request, sizeof(request)};
+        iov[1] = {headers.data(), headers.size() * sizeof(RemoteExtentHeader)};
+        for (size_t e = first; e < i; e++) {
+            headers[e - first] = RemoteExtentHeader{htobe64(extents[e].offset), htobe32(extents[e].len),
+                                                    htobe32(crc32c(extents[e].data, extents[e].len))};
+            iov[2 + e - first] = {const_cast<char*>(extents[e].data), extents[e].len};
+        }
+
+        if (outstanding == window) {
+            readReply("put batch", &error);
+            outstanding--;
+            if (error != 0)
+                break;
+        }
+        send(iov.data(), static_cast<int>(iov.size()));
+        outstanding++;
+    }
+
+    // Every reply is read even after an error, so none is left for a later request to mistake for its own
+    while (outstanding > 0) {
+        int batchError = 0;
+        readReply("put batch", &batchError);
+        if (error == 0)
+            error = batchError;
+        outstanding--;
+    }
+    if (error != 0)
+        throw std::system_error(error, std::generic_category(), "remote put batch");
+}
+
+void TcpRemoteStore::zero(uint64_t offset, uint64_t len) {
+    constexpr uint64_t MAX_ZERO_LENGTH = 1U << 30;  // Fits the 32-bit length field
+    std::lock_guard<std::mutex> lock(sockMutex);
+    ensureConnected();
+    size_t outstanding = 0;
+    for (uint64_t done = 0; done < len; done += MAX_ZERO_LENGTH) {
+        RemoteRequest request =
+            makeRemoteRequest(RemoteCommand::Zero, offset + done, static_cast<uint32_t>(std::min(MAX_ZERO_LENGTH, len - done)));
+        send(&request, sizeof(request));
+        outstanding++;
+    }
+    int error = 0;
+    while (outstanding > 0) {
+        int requestError = 0;
+        readReply("zero", &requestError);
+        if (error == 0)
+            error = requestError;
+        outstanding--;
+    }
+    if (error != 0)
+        throw std::system_error(error, std::generic_category(), "remote zero");
+}
+
+void TcpRemoteStore::get(uint64_t offset, char* data, uint32_t len) {
+    std::lock_guard<std::mutex> lock(sockMutex);
+    ensureConnected();
+    RemoteRequest request = makeRemoteRequest(RemoteCommand::Get, offset, len);
+    send(&request, sizeof(request));
+    uint32_t crc = static_cast<uint32_t>(readReply("get"));
+    receive(data, len, "get");
+    if (crc32c(data, len) != crc)
+        throw std::system_error(EBADMSG, std::generic_category(), "checksum mismatch in data fetched from remote");
+}
+
+void TcpRemoteStore::flush() {
+    std::lock_guard<std::mutex> lock(sockMutex);
+    ensureConnected();
+    RemoteRequest request = makeRemoteRequest(RemoteCommand::Flush, 0, 0);
+    send(&request, sizeof(request));
+    readReply("flush");
+}
+
+void TcpRemoteStore::hashes(uint32_t level, uint64_t first, uint64_t count, uint64_t* out) {
+    std::lock_guard<std::mutex> lock(sockMutex);
+    ensureConnected();
+    while (count > 0) {
+        uint32_t nodes = static_cast<uint32_t>(std::min<uint64_t>(count, REMOTE_MAX_HASH_NODES));
+        uint64_t position = (static_cast<uint64_t>(level) << REMOTE_HASH_LEVEL_SHIFT) | first;
+        RemoteRequest request = makeRemoteRequest(RemoteCommand::Hash, position, nodes);
+        send(&request, sizeof(request));
+        readReply("hash");
+        receive(out, nodes * sizeof(uint64_t), "hash");
+        for (uint32_t i = 0; i < nodes; i++) {
+            out[i] = be64toh(out[i]);
+        }
+        first += nodes;
+        out += nodes;
+        count -= nodes;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef TCP_REMOTE_STORE_H
+#define TCP_REMOTE_STORE_H
+
+#include <mutex>
+#include <string>
+
+#include "remotestore.hpp"
+
+/**
+ * @brief Remote store reached over TCP, served by buse_remote.
+ *
+ * A connection whose request and reply streams may be out of step, after a failed or partial send, a closed
+ * connection or a malformed reply, is closed, and the next request reconnects first. A request the server
+ * answers with an error leaves the connection usable, as every outstanding reply is read before the error is
+ * reported.
+ */
+class TcpRemoteStore : public RemoteStore {
+   public:
+    /**
+     * @brief Connects to a remote server and queries its size.
+     * @param endpoint The server address as host:port.
+     * @throws std::system_error if the server cannot be reached.
+     */
+    explicit TcpRemoteStore(const std::string& endpoint);
+    ~TcpRemoteStore() override;
+
+    uint64_t size() const override { return remoteSize; }
+    void put(uint64_t offset, const char* data, uint32_t len) override;
+    void putMany(const RemoteExtent* extents, size_t count, uint32_t batchBytes, size_t window) override;
+    void zero(uint64_t offset, uint64_t len) override;
+    void get(uint64_t offset, char* data, uint32_t len) override;
+    void flush() override;
+    void hashes(uint32_t level, uint64_t first, uint64_t count, uint64_t* out) override;
+
+   private:
+    std::string endpoint;
+    int sock = -1;  // -1 while disconnected
+    uint64_t remoteSize = 0;
+    std::mutex sockMutex;  // One request/reply exchange at a time, guards sock
+
+    /**
+     * @brief Reconnects if the previous connection was dropped. Must be called with sockMutex held.
+     * @throws std::system_error if the server cannot be reached or no longer has the same size.
+     */
+    void ensureConnected();
+
+    /**
+     * @brief Closes the connection, so the next request starts on a fresh one.
+     */
+    void disconnect();
+
+    /**
+     * @brief Sends iovecs in full, dropping the connection if that fails. The iovec array is modified.
+     */
+    void send(struct iovec* iov, int iovcnt);
+    void send(const void* buf, size_t len);
+
+    /**
+     * @brief Receives exactly len bytes, dropping the connection if that fails.
+     */
+    void receive(void* buf, size_t len, const char* what);
+
+    /**
+     * @brief Reads one reply and checks its magic and error.
+     * @param what The request, for error messages.
+     * @param error Receives the error of an error reply instead of throwing it, if not null.
+     * @return The reply value, 0 for an error reply.
+     * @throws std::system_error for an error reply, or after dropping the connection if no valid reply arrives.
+     */
+    uint64_t readReply(const char* what, int* error = nullptr);
+};
+
+#endif  // TCP_REMOTE_STORE_H
@@ -0,0 +1,72 @@
+#include <exception>
+
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        stopping = true;
+    }
+    tasksCV.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        tasks.emplace_back(std::move(task));
+    }
+    tasksCV.notify_one();
+}
+
+void ThreadPool::forEach(size_t count, const std::function<void(size_t)>& task) {
+    std::mutex doneMutex;
+    std::condition_variable doneCV;
+    size_t remaining = count;
+    std::exception_ptr error;
+
+    for (size_t i = 0; i < count; i++) {
+        submit([&, i]() {
+            std::exception_ptr taskError;
+            try {
+                task(i);
+            } catch (...) {
+                taskError = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (taskError && !error)
+                error = taskError;
+            if (--remaining == 0)
+                doneCV.notify_one();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCV.wait(lock, [&] { return remaining == 0; });
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(tasksMutex);
+            tasksCV.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;  // Stopping and fully drained
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
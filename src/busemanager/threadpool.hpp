@@ -0,0 +1,54 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads executing queued tasks in FIFO order.
+ */
+class ThreadPool {
+   public:
+    explicit ThreadPool(size_t threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Queues a task for execution on one of the worker threads.
+     * @param task The task to run.
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief Runs task(0) .. task(count - 1) on the worker threads and waits for all of them.
+     * @param count The number of tasks.
+     * @param task The task to run, called with its index.
+     *
+     * If any task throws, the first exception is rethrown once every task has finished. Must not be called
+     * from one of the pool's own workers.
+     */
+    void forEach(size_t count, const std::function<void(size_t)>& task);
+
+    /**
+     * @brief Returns the number of worker threads.
+     * @return The number of worker threads.
+     */
+    size_t size() const { return workers.size(); }
+
+   private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksCV;
+    bool stopping = false;
+
+    void workerLoop();
+};
+
+#endif  // THREAD_POOL_H
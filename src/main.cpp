@@ -7,7 +7,9 @@
 #include <cxxopts.hpp>
 
 std::unique_ptr<BuseManager> buseManager;
+std::unique_ptr<ThreadPool> ioWorkers;
 std::thread syncThread;
+static bool verifyReads = false;
 
 static int xmp_read(void* buf, uint32_t len, uint64_t offset, void* verbose) {
     if (*(int*)verbose)
@@ -18,13 +20,43 @@ static int xmp_read(void* buf, uint32_t len, uint64_t offset, void* verbose) {
         return 0;
     }
 
+    buseManager->noteRead(offset, len);
+    if (!buseManager->hydrate(offset, len))
+        return EIO;
+    RangeGuard lock(BuseManager::rangeLocks, offset, len, false);
+    if (verifyReads && !buseManager->verifyChecksums(offset, len))
+        return EIO;
     std::memcpy(buf, BuseManager::buffer.get() + offset, len);
     return 0;
 }
 
-static int xmp_write(const void* buf, uint32_t len, uint64_t offset, void* verbose) {
-    std::lock_guard<std::mutex> lock(BuseManager::writeMutex);
+// Zero-copy read: the range stays locked shared until xmp_read_end, after the data has been sent.
+static int xmp_read_ref(const void** data, uint32_t len, uint64_t offset, void* verbose) {
+    if (*(int*)verbose)
+        LOG_F(INFO, "R - %lu, %u", offset, len);
+
+    if (__builtin_expect((offset + len > buseManager->getBufferSize()), 0)) {
+        LOG_F(ERROR, "Read request out of bounds - %lu, %u", offset, len);
+        return EIO;
+    }
+
+    buseManager->noteRead(offset, len);
+    if (!buseManager->hydrate(offset, len))
+        return EIO;
+    BuseManager::rangeLocks.lockShared(offset, len);
+    if (verifyReads && !buseManager->verifyChecksums(offset, len)) {
+        BuseManager::rangeLocks.unlockShared(offset, len);
+        return EIO;
+    }
+    *data = BuseManager::buffer.get() + offset;
+    return 0;
+}
 
+static void xmp_read_end(uint32_t len, uint64_t offset, void* /*verbose*/) {
+    BuseManager::rangeLocks.unlockShared(offset, len);
+}
+
+static int xmp_write(const void* buf, uint32_t len, uint64_t offset, void* verbose) {
     if (*(int*)verbose)
         LOG_F(INFO, "W - %lu, %u", offset, len);
 
@@ -33,7 +65,50 @@ static int xmp_write(const void* buf, uint32_t len, uint64_t offset, void* verbo
         return 0;
     }
 
-    std::memcpy(BuseManager::buffer.get() + offset, buf, len);
+    if (!buseManager->hydrateEdges(offset, len))
+        return EIO;
+    {
+        RangeGuard lock(BuseManager::rangeLocks, offset, len, true);
+        buseManager->prepareWrite(offset, len);
+        std::memcpy(BuseManager::buffer.get() + offset, buf, len);
+        buseManager->markDirty(offset, len);
+    }
+    if (!buseManager->commitWrite())
+        return EIO;
+
+    if (buseManager->getHasWrites().load() == false) {
+        buseManager->getHasWrites().store(true);
+    }
+
+    return 0;
+}
+
+// Zero-copy write: the payload is received straight into the buffer while the range is locked, and the blocks
+// are only marked dirty once the payload has landed. buse only takes this path when the whole payload is already
+// queued on the socket, so the lock is held for a copy out of the socket buffer as in xmp_write, never for a
+// network wait; other writes go through xmp_write.
+static int xmp_write_begin(void** dest, uint32_t len, uint64_t offset, void* verbose) {
+    if (*(int*)verbose)
+        LOG_F(INFO, "W - %lu, %u", offset, len);
+
+    if (__builtin_expect((offset + len > buseManager->getBufferSize()), 0)) {
+        LOG_F(ERROR, "Write request out of bounds - %lu, %u", offset, len);
+        return EIO;
+    }
+
+    if (!buseManager->hydrateEdges(offset, len))
+        return EIO;
+    BuseManager::rangeLocks.lock(offset, len);
+    buseManager->prepareWrite(offset, len);
+    *dest = BuseManager::buffer.get() + offset;
+    return 0;
+}
+
+static int xmp_write_end(uint32_t len, uint64_t offset, void* /*verbose*/) {
+    buseManager->markDirty(offset, len);
+    BuseManager::rangeLocks.unlock(offset, len);
+    if (!buseManager->commitWrite())
+        return EIO;
 
     if (buseManager->getHasWrites().load() == false) {
         buseManager->getHasWrites().store(true);
@@ -51,13 +126,100 @@ static void xmp_disc(void* verbose) {
 static int xmp_flush(void* verbose) {
     if (*(int*)verbose)
         LOG_F(INFO, "Flush");
-    buseManager->synchronizeData();
+    // A journal makes acknowledged writes durable locally, so the remote store is left to the periodic sync
+    if (buseManager->hasJournal())
+        return buseManager->commitJournal() ? 0 : EIO;
+    return buseManager->flush() ? 0 : EIO;
+}
+
+// Shared by trim and write zeroes, which differ in whether partial blocks at the edges are cleared; write zeroes
+// with NBD_CMD_FLAG_NO_HOLE also keeps the range allocated.
+static int discardRange(uint64_t offset, uint32_t len, bool zeroEdges, bool keepAllocated = false) {
+    if (__builtin_expect((offset + len > buseManager->getBufferSize()), 0)) {
+        LOG_F(ERROR, "%s request out of bounds - %lu, %u", zeroEdges ? "Write zeroes" : "Trim", offset, len);
+        return EIO;
+    }
+
+    // Trims leave partial blocks alone, zeroing clears part of them and needs the rest
+    if (zeroEdges && !buseManager->hydrateEdges(offset, len))
+        return EIO;
+    try {
+        RangeGuard lock(BuseManager::rangeLocks, offset, len, true);
+        if (zeroEdges)
+            buseManager->zeroRange(offset, len, keepAllocated);
+        else
+            buseManager->trim(offset, len);
+    } catch (const std::system_error& e) {
+        LOG_F(ERROR, "%s failed: %s", zeroEdges ? "Write zeroes" : "Trim", e.what());
+        return e.code().value();
+    }
+    if (!buseManager->commitWrite())
+        return EIO;
+
+    if (buseManager->getHasWrites().load() == false) {
+        buseManager->getHasWrites().store(true);
+    }
+
     return 0;
 }
 
 static int xmp_trim(uint64_t offset, uint32_t len, void* verbose) {
     if (*(int*)verbose)
         LOG_F(INFO, "Trim - %lu, %u", offset, len);
+    return discardRange(offset, len, false);
+}
+
+static int xmp_write_zeroes(uint64_t offset, uint32_t len, int noHole, void* verbose) {
+    if (*(int*)verbose)
+        LOG_F(INFO, "Z - %lu, %u%s", offset, len, noHole ? " (no hole)" : "");
+    return discardRange(offset, len, true, noHole != 0);
+}
+
+static int xmp_sync_range(uint64_t offset, uint32_t len, void* verbose) {
+    if (*(int*)verbose)
+        LOG_F(INFO, "FUA - %lu, %u", offset, len);
+
+    if (__builtin_expect((offset + len > buseManager->getBufferSize()), 0))
+        return EIO;
+    if (buseManager->hasJournal())
+        return buseManager->commitJournal() ? 0 : EIO;
+    return buseManager->syncRange(offset, len) ? 0 : EIO;
+}
+
+static int xmp_submit(struct buse_request* req, void* verbose) {
+    if (req->type == BUSE_CMD_FLUSH && !buseManager->hasJournal()) {
+        // Completed from the sync thread once its epoch is durable, so no worker sits waiting for it
+        if (*(int*)verbose)
+            LOG_F(INFO, "Flush");
+        buseManager->flushAsync([req](bool durable) { buse_complete(req, durable ? 0 : EIO); });
+        return 0;
+    }
+
+    ioWorkers->submit([req, verbose]() {
+        int err = 0;
+        switch (req->type) {
+            case BUSE_CMD_READ:
+                err = xmp_read_ref(&req->data, req->len, req->from, verbose);
+                break;
+            case BUSE_CMD_WRITE:
+                err = xmp_write(req->buf, req->len, req->from, verbose);
+                if (err == 0 && req->fua)
+                    err = xmp_sync_range(req->from, req->len, verbose);
+                break;
+            case BUSE_CMD_FLUSH:
+                err = xmp_flush(verbose);  // Only with a journal, otherwise handled above
+                break;
+            case BUSE_CMD_TRIM:
+                err = xmp_trim(req->from, req->len, verbose);
+                break;
+            case BUSE_CMD_WRITE_ZEROES:
+                err = xmp_write_zeroes(req->from, req->len, req->no_hole, verbose);
+                if (err == 0 && req->fua)
+                    err = xmp_sync_range(req->from, req->len, verbose);
+                break;
+        }
+        buse_complete(req, err);
+    });
     return 0;
 }
 
@@ -66,7 +228,6 @@ static int xmp_init(void* verbose) {
         LOG_F(INFO, "Init");
 
     syncThread = std::thread(&BuseManager::runPeriodicSync, buseManager.get());
-    buseManager->getHasWrites().store(false);
 
     return 0;
 }
@@ -78,7 +239,27 @@ int main(int argc, char* argv[]) {
     // clang-format off
     options.add_options()
         ("d,dev", "NBD Device path", cxxopts::value<std::string>()->default_value("/dev/nbd0"))
-        ("s,size", "Block device size in bytes", cxxopts::value<int>()->default_value("1048576"))
+        ("s,size", "Block device size in bytes, defaults to the size of an existing image", cxxopts::value<uint64_t>()->default_value("1048576"))
+        ("i,image", "Sparse image file backing the device, memory only if not given", cxxopts::value<std::string>()->default_value(""))
+        ("r,remote", "host:port of a buse_remote server to sync to, in-memory remote if not given", cxxopts::value<std::string>()->default_value(""))
+        ("sync-batch", "Bytes of dirty ranges sent to the remote as one request", cxxopts::value<uint32_t>()->default_value("1048576"))
+        ("sync-window", "Number of sync requests in flight at once", cxxopts::value<size_t>()->default_value("8"))
+        ("max-transfer", "Longest range of adjacent dirty blocks uploaded as one extent", cxxopts::value<uint32_t>()->default_value("1048576"))
+        ("scan-threads", "Number of threads scanning the dirty map and verifying, 0 uses one per core", cxxopts::value<size_t>()->default_value("0"))
+        ("verify", "Read the remote back and compare it with the device after the final sync")
+        ("verify-reads", "Keep a CRC32C checksum of every written block and check reads against it")
+        ("hydrate", "Start from the contents of the remote, fetching blocks on first access and in the background")
+        ("overwrite-remote", "Start even if the remote holds other data than the device, replacing it with the device's")
+        ("hydrate-threads", "Number of threads hydrating in the background, 0 uses one per core", cxxopts::value<size_t>()->default_value("4"))
+        ("j,journal", "Directory of a write-ahead journal that makes writes durable locally before they are acknowledged", cxxopts::value<std::string>()->default_value(""))
+        ("journal-flush-only", "Commit the journal on flush and FUA only, like a disk with a volatile write cache")
+        ("readahead", "Largest readahead window of a sequential read stream in bytes, 0 disables readahead", cxxopts::value<uint64_t>()->default_value("4194304"))
+        ("c,connections", "Number of NBD connections, each served by its own thread", cxxopts::value<uint32_t>()->default_value("1"))
+        ("e,engine", "Socket I/O engine, blocking or uring; uring batches replies but copies every read, as a zero-copy read would hold its range lock until the batch is sent", cxxopts::value<std::string>()->default_value("blocking"))
+        ("a,async-workers", "Number of threads completing requests asynchronously, 0 serves them inline", cxxopts::value<uint32_t>()->default_value("0"))
+        ("pool-buffers", "Preallocated request buffers per connection", cxxopts::value<uint32_t>()->default_value("32"))
+        ("pool-buffer-size", "Size of each request buffer in bytes", cxxopts::value<uint32_t>()->default_value("1048576"))
+        ("hugepages", "Back request buffers with hugepages")
         ("v,verbose", "Enable verbose output", cxxopts::value<int>()->default_value("1"))
         ("h,help", "Print usage")
     ;
@@ -91,22 +272,77 @@ int main(int argc, char* argv[]) {
 
     loguru::init(argc, argv);
     LOG_F(INFO, "Starting buse_nfs");
-    LOG_F(INFO, "Creating block device at %s with size %d bytes", result["dev"].as<std::string>().c_str(), result["size"].as<int>());
+    const std::string& image = result["image"].as<std::string>();
+    uint64_t size = result["size"].as<uint64_t>();
+    if (!image.empty() && result.count("size") == 0 && access(image.c_str(), F_OK) == 0)
+        size = 0;  // Keep the size of the existing image
+    bool hydrate = result.count("hydrate") != 0;
+    if (hydrate && result.count("size") == 0 && !result["remote"].as<std::string>().empty())
+        size = 0;  // Take the size of the remote
 
-    buseManager = std::make_unique<BuseManager>(result["size"].as<int>());
+    try {
+        buseManager = std::make_unique<BuseManager>(size, image, result["remote"].as<std::string>(), hydrate,
+                                                    result.count("overwrite-remote") != 0);
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Failed to create buffer: %s", e.what());
+        return 1;
+    }
+    buseManager->setSyncPipeline(result["sync-batch"].as<uint32_t>(), result["sync-window"].as<size_t>(),
+                                 result["max-transfer"].as<uint32_t>());
+    buseManager->setScanThreads(result["scan-threads"].as<size_t>());
+    verifyReads = result.count("verify-reads") != 0;
+    if (verifyReads) {
+        buseManager->enableChecksums();
+        LOG_F(INFO, "Verifying reads with the %s CRC32C kernel", crc32cKernel());
+    }
+    if (!result["journal"].as<std::string>().empty()) {
+        try {
+            buseManager->openJournal(result["journal"].as<std::string>(), result.count("journal-flush-only") == 0);
+        } catch (const std::system_error& e) {
+            LOG_F(ERROR, "Failed to open journal: %s", e.what());
+            return 1;
+        }
+    }
+    buseManager->setReadahead(result["readahead"].as<uint64_t>());
+    buseManager->startHydration(result["hydrate-threads"].as<size_t>());
+    LOG_F(INFO, "Creating block device at %s with size %lu bytes", result["dev"].as<std::string>().c_str(), buseManager->getBufferSize());
 
     // Start buse
-    struct buse_operations aop = {
-        xmp_read,                                          // read
-        xmp_write,                                         // write
-        xmp_disc,                                          // disc
-        xmp_flush,                                         // flush
-        xmp_trim,                                          // trim
-        xmp_init,                                          // init
-        static_cast<u_int64_t>(result["size"].as<int>()),  // size
-        512,                                               // blksize
-        0  // size_blocks, setting other than 0 causes out of bound reads and writes for some reason
-    };
+    struct buse_operations aop = {};
+    aop.read = xmp_read;
+    aop.read_ref = xmp_read_ref;
+    aop.read_end = xmp_read_end;
+    aop.write = xmp_write;
+    aop.write_begin = xmp_write_begin;
+    aop.write_end = xmp_write_end;
+    aop.disc = xmp_disc;
+    aop.flush = xmp_flush;
+    aop.trim = xmp_trim;
+    aop.write_zeroes = xmp_write_zeroes;
+    aop.sync_range = xmp_sync_range;
+    aop.init = xmp_init;
+    if (result["async-workers"].as<uint32_t>() > 0) {
+        ioWorkers = std::make_unique<ThreadPool>(result["async-workers"].as<uint32_t>());
+        aop.submit = xmp_submit;
+    }
+    aop.size = buseManager->getBufferSize();
+    aop.blksize = 512;
+    aop.size_blocks = 0;  // setting other than 0 causes out of bound reads and writes for some reason
+    aop.connections = result["connections"].as<uint32_t>();
+
+    aop.pool_buffers = result["pool-buffers"].as<uint32_t>();
+    aop.pool_buffer_size = result["pool-buffer-size"].as<uint32_t>();
+    aop.pool_hugepages = result.count("hugepages") ? 1 : 0;
+
+    const std::string& engine = result["engine"].as<std::string>();
+    if (engine == "uring") {
+        // read_end is set, so uring serves reads through xmp_read: the reply batch is sent after the thread has
+        // moved on to later requests, which could then wait for a range lock it still holds
+        aop.engine = BUSE_ENGINE_URING;
+    } else if (engine != "blocking") {
+        LOG_F(ERROR, "Unknown engine %s", engine.c_str());
+        return 1;
+    }
 
     std::thread buseThread([&]() {
         if (buse_main(result["dev"].as<std::string>().c_str(), &aop, (void*)&result["verbose"].as<int>()) != 0) {
@@ -126,6 +362,16 @@ int main(int argc, char* argv[]) {
         syncThread.join();
     }
 
+    ioWorkers.reset();
+
+    if (result.count("verify")) {
+        LOG_F(INFO, "Verifying remote: %s", buseManager->verifyRemote() ? "in sync" : "NOT in sync");
+    }
+
+    u_int64_t poolHits, poolMisses;
+    buse_pool_counters(&poolHits, &poolMisses);
+    LOG_F(INFO, "Request buffer pool: %lu hits, %lu misses", poolHits, poolMisses);
+
     LOG_F(INFO, "Exiting buse_nfs");
 
     return 0;
@@ -7,6 +7,8 @@
 #include "cxxopts.hpp"
 #include "buse.h"
 #include "busemanager.hpp"
+#include "crc32c.hpp"
+#include "threadpool.hpp"
 
 static int init_options(const int argc, char** argv, cxxopts::Options& options, cxxopts::ParseResult& result) {
     result = options.parse(argc, argv);
@@ -0,0 +1,207 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <cxxopts.hpp>
+#include <loguru.hpp>
+
+#include "crc32c.hpp"
+#include "memoryremotestore.hpp"
+#include "remoteprotocol.hpp"
+#include "socketio.hpp"
+
+// Stand-in for a remote storage server: serves one MemoryRemoteStore to any number of TcpRemoteStore clients.
+
+static void serveClient(int sock, RemoteStore* store, int verbose) {
+    std::vector<char> payload;
+    std::vector<RemoteExtentHeader> extents;
+    // Checked before allocating, so a bogus length cannot make the server allocate without bound
+    const uint64_t maxPayload = std::min<uint64_t>(REMOTE_MAX_PAYLOAD, store->size());
+
+    try {
+        RemoteRequest request;
+        while (recvAll(sock, &request, sizeof(request))) {
+            if (be32toh(request.magic) != REMOTE_REQUEST_MAGIC) {
+                LOG_F(ERROR, "Bad request magic, dropping client");
+                break;
+            }
+
+            auto command = static_cast<RemoteCommand>(be32toh(request.command));
+            uint64_t offset = be64toh(request.offset);
+            uint32_t len = be32toh(request.len);
+            if (verbose)
+                LOG_F(INFO, "%u - %lu, %u", static_cast<uint32_t>(command), offset, len);
+
+            uint32_t error = 0;
+            uint64_t value = 0;
+            size_t replyBytes = 0;  // Payload bytes following the reply
+            switch (command) {
+                case RemoteCommand::Size:
+                    value = store->size();
+                    break;
+                case RemoteCommand::Put:
+                    // The payload that follows cannot be skipped safely, so an oversized request drops the client
+                    if (len > maxPayload)
+                        throw std::system_error(EINVAL, std::generic_category(), "put payload too large");
+                    payload.resize(len);
+                    if (!recvAll(sock, payload.data(), len))
+                        throw std::system_error(ECONNRESET, std::generic_category(), "connection closed mid-request");
+                    try {
+                        store->put(offset, payload.data(), len);
+                    } catch (const std::system_error& e) {
+                        error = static_cast<uint32_t>(e.code().value());
+                    }
+                    break;
+                case RemoteCommand::PutBatch: {
+                    if (offset > REMOTE_MAX_BATCH_EXTENTS || len > maxPayload)
+                        throw std::system_error(EINVAL, std::generic_category(), "put batch too large");
+                    extents.resize(offset);
+                    payload.resize(len);
+                    if (!recvAll(sock, extents.data(), extents.size() * sizeof(RemoteExtentHeader)) || !recvAll(sock, payload.data(), len))
+                        throw std::system_error(ECONNRESET, std::generic_category(), "connection closed mid-request");
+                    uint64_t position = 0;
+                    for (const auto& extent : extents) {
+                        uint32_t extentLen = be32toh(extent.len);
+                        if (position + extentLen > len) {
+                            error = EINVAL;
+                            break;
+                        }
+                        if (crc32c(payload.data() + position, extentLen) != be32toh(extent.crc)) {
+                            LOG_F(ERROR, "Checksum mismatch in extent %lu, %u", be64toh(extent.offset), extentLen);
+                            error = EBADMSG;
+                            break;
+                        }
+                        try {
+                            store->put(be64toh(extent.offset), payload.data() + position, extentLen);
+                        } catch (const std::system_error& e) {
+                            error = static_cast<uint32_t>(e.code().value());
+                            break;
+                        }
+                        position += extentLen;
+                    }
+                    break;
+                }
+                case RemoteCommand::Zero:
+                    try {
+                        store->zero(offset, len);
+                    } catch (const std::system_error& e) {
+                        error = static_cast<uint32_t>(e.code().value());
+                    }
+                    break;
+                case RemoteCommand::Get:
+                    if (len > maxPayload) {
+                        error = EINVAL;
+                        break;
+                    }
+                    payload.resize(len);
+                    try {
+                        store->get(offset, payload.data(), len);
+                        value = crc32c(payload.data(), len);
+                        replyBytes = len;
+                    } catch (const std::system_error& e) {
+                        error = static_cast<uint32_t>(e.code().value());
+                    }
+                    break;
+                case RemoteCommand::Hash: {
+                    if (len > REMOTE_MAX_HASH_NODES) {
+                        error = EINVAL;
+                        break;
+                    }
+                    payload.resize(len * sizeof(uint64_t));
+                    auto* nodes = reinterpret_cast<uint64_t*>(payload.data());
+                    try {
+                        store->hashes(static_cast<uint32_t>(offset >> REMOTE_HASH_LEVEL_SHIFT), offset & REMOTE_HASH_INDEX_MASK, len, nodes);
+                        for (uint32_t i = 0; i < len; i++) {
+                            nodes[i] = htobe64(nodes[i]);
+                        }
+                        replyBytes = payload.size();
+                    } catch (const std::system_error& e) {
+                        error = static_cast<uint32_t>(e.code().value());
+                    }
+                    break;
+                }
+                case RemoteCommand::Flush:
+                    try {
+                        store->flush();
+                    } catch (const std::system_error& e) {
+                        error = static_cast<uint32_t>(e.code().value());
+                    }
+                    break;
+                default:
+                    error = EINVAL;
+                    break;
+            }
+
+            RemoteReply reply = makeRemoteReply(error, value);
+            struct iovec iov[2] = {{&reply, sizeof(reply)}, {payload.data(), replyBytes}};
+            sendvAll(sock, iov, replyBytes != 0 ? 2 : 1);
+        }
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Client failed: %s", e.what());
+    }
+    close(sock);
+    LOG_F(INFO, "Client disconnected");
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options("buse_remote", "Remote storage server for buse_nfs");
+
+    // clang-format off
+    options.add_options()
+        ("p,port", "TCP port to listen on", cxxopts::value<uint16_t>()->default_value("10809"))
+        ("s,size", "Storage size in bytes, defaults to the size of an existing image", cxxopts::value<uint64_t>()->default_value("1048576"))
+        ("i,image", "Sparse image file holding the storage, memory only if not given", cxxopts::value<std::string>()->default_value(""))
+        ("v,verbose", "Enable verbose output", cxxopts::value<int>()->default_value("0"))
+        ("h,help", "Print usage")
+    ;
+    // clang-format on
+
+    cxxopts::ParseResult result = options.parse(argc, argv);
+    if (result.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 1;
+    }
+
+    loguru::init(argc, argv);
+
+    const std::string& image = result["image"].as<std::string>();
+    uint64_t size = result["size"].as<uint64_t>();
+    if (!image.empty() && result.count("size") == 0 && access(image.c_str(), F_OK) == 0)
+        size = 0;  // Keep the size of the existing image
+
+    std::unique_ptr<MemoryRemoteStore> store;
+    int listener = -1;
+    try {
+        store = std::make_unique<MemoryRemoteStore>(image.empty() ? MappedBuffer::anonymous(size) : MappedBuffer::file(image, size));
+        listener = listenTcp(result["port"].as<uint16_t>());
+    } catch (const std::exception& e) {
+        LOG_F(ERROR, "Failed to start: %s", e.what());
+        return 1;
+    }
+    LOG_F(INFO, "Serving %lu bytes on port %u", store->size(), result["port"].as<uint16_t>());
+
+    while (true) {
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client == -1) {
+            if (errno == EINTR)
+                continue;
+            LOG_F(ERROR, "accept failed: %s", strerror(errno));
+            break;
+        }
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        LOG_F(INFO, "Client connected");
+        std::thread(serveClient, client, store.get(), result["verbose"].as<int>()).detach();
+    }
+
+    close(listener);
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Drives one connection of each engine through a socketpair, standing in for
+ * the kernel side of NBD. Includes buse.c to reach the connection internals.
+ */
+
+#include "buse.c"
+
+#define CHECK(condition)                                                                        \
+    do {                                                                                        \
+        if (!(condition)) {                                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+            exit(1);                                                                            \
+        }                                                                                       \
+    } while (0)
+
+#define IMAGE_SIZE (1024 * 1024)
+
+static char image[IMAGE_SIZE];
+/* Set by the serving thread, which the socket orders before the reply but not
+ * visibly to thread sanitizers. */
+static int zeroes_calls;
+static int last_no_hole;
+static int sync_calls;
+
+static int load(int* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static int test_read(void* buf, u_int32_t len, u_int64_t offset, void* userdata) {
+    (void)userdata;
+    memcpy(buf, image + offset, len);
+    return 0;
+}
+
+static int test_write(const void* buf, u_int32_t len, u_int64_t offset, void* userdata) {
+    (void)userdata;
+    memcpy(image + offset, buf, len);
+    return 0;
+}
+
+static int test_write_zeroes(u_int64_t from, u_int32_t len, int no_hole, void* userdata) {
+    (void)userdata;
+    memset(image + from, 0, len);
+    __atomic_store_n(&last_no_hole, no_hole, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&zeroes_calls, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int test_sync_range(u_int64_t from, u_int32_t len, void* userdata) {
+    (void)from;
+    (void)len;
+    (void)userdata;
+    __atomic_fetch_add(&sync_calls, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Completes every request before returning, which the API allows. */
+static int test_submit(struct buse_request* req, void* userdata) {
+    int error = 0;
+
+    switch (req->type) {
+        case BUSE_CMD_READ:
+            error = test_read(req->buf, req->len, req->from, userdata);
+            break;
+        case BUSE_CMD_WRITE:
+            error = test_write(req->buf, req->len, req->from, userdata);
+            break;
+        case BUSE_CMD_WRITE_ZEROES:
+            error = test_write_zeroes(req->from, req->len, req->no_hole, userdata);
+            break;
+        default:
+            error = EINVAL;
+            break;
+    }
+    if (error == 0 && req->fua)
+        error = test_sync_range(req->from, req->len, userdata);
+    buse_complete(req, error);
+    return 0;
+}
+
+static void send_request(int sk, u_int32_t type, u_int64_t from, u_int32_t len, const void* payload) {
+    struct nbd_request request;
+    struct iovec iov[2];
+
+    memset(&request, 0, sizeof(request));
+    request.magic = htonl(NBD_REQUEST_MAGIC);
+    request.type = htonl(type);
+    request.from = htonll(from);
+    request.len = htonl(len);
+    memcpy(request.handle, &from, sizeof(request.handle));
+    iov[0].iov_base = &request;
+    iov[0].iov_len = sizeof(request);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = len;
+    CHECK(writev_all(sk, iov, payload ? 2 : 1) == 0);
+}
+
+/* Returns the error of the reply, in host byte order. */
+static u_int32_t recv_reply(int sk, void* payload, u_int32_t len) {
+    struct nbd_reply reply;
+
+    CHECK(read_all(sk, (char*)&reply, sizeof(reply)) == 0);
+    CHECK(reply.magic == htonl(NBD_REPLY_MAGIC));
+    if (reply.error == 0 && payload)
+        CHECK(read_all(sk, payload, len) == 0);
+    return ntohl(reply.error);
+}
+
+static void run(const char* name, const struct buse_operations* aop) {
+    struct buse_server server = {aop, NULL, PTHREAD_MUTEX_INITIALIZER, 0};
+    struct buse_conn conn;
+    static char data[3 * 4096];
+    static char expected[3 * 4096];
+    int sp[2];
+    int i;
+
+    memset(image, 0, sizeof(image));
+    zeroes_calls = 0;
+    sync_calls = 0;
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == 0);
+    memset(&conn, 0, sizeof(conn));
+    conn.server = &server;
+    conn.sk = sp[0];
+    conn.kernel_sk = sp[1];
+    pthread_mutex_init(&conn.lock, NULL);
+    pthread_cond_init(&conn.idle, NULL);
+    conn.pool = bufpool_create(4, 65536, 0);
+    CHECK(pthread_create(&conn.thread, NULL, serve_nbd_thread, &conn) == 0);
+
+    memset(data, 0x11, sizeof(data));
+    send_request(sp[1], NBD_CMD_WRITE, 4096, sizeof(data), data);
+    CHECK(recv_reply(sp[1], NULL, 0) == 0);
+
+    /* Write zeroes clears exactly its range and passes NO_HOLE on */
+    send_request(sp[1], NBD_CMD_WRITE_ZEROES | NBD_CMD_FLAG_NO_HOLE, 4096 + 100, 5000, NULL);
+    CHECK(recv_reply(sp[1], NULL, 0) == 0);
+    CHECK(load(&zeroes_calls) == 1 && load(&last_no_hole));
+    send_request(sp[1], NBD_CMD_WRITE_ZEROES, 4096 + 8000, 10, NULL);
+    CHECK(recv_reply(sp[1], NULL, 0) == 0);
+    CHECK(load(&zeroes_calls) == 2 && !load(&last_no_hole));
+
+    /* Only writes and write zeroes flagged FUA are synced before their reply */
+    CHECK(load(&sync_calls) == 0);
+    send_request(sp[1], NBD_CMD_WRITE | NBD_CMD_FLAG_FUA, 4096, 100, data);
+    CHECK(recv_reply(sp[1], NULL, 0) == 0);
+    CHECK(load(&sync_calls) == 1);
+    send_request(sp[1], NBD_CMD_WRITE_ZEROES | NBD_CMD_FLAG_FUA, 4096 + 8000, 10, NULL);
+    CHECK(recv_reply(sp[1], NULL, 0) == 0);
+    CHECK(load(&sync_calls) == 2 && load(&zeroes_calls) == 3);
+
+    memcpy(expected, data, sizeof(expected));
+    memset(expected + 100, 0, 5000);
+    memset(expected + 8000, 0, 10);
+    send_request(sp[1], NBD_CMD_READ, 4096, sizeof(data), NULL);
+    CHECK(recv_reply(sp[1], data, sizeof(data)) == 0);
+    CHECK(memcmp(data, expected, sizeof(data)) == 0);
+
+    /* Commands buse does not know are refused instead of ending the connection */
+    send_request(sp[1], 9, 0, 0, NULL);
+    CHECK(recv_reply(sp[1], NULL, 0) == EINVAL);
+
+    send_request(sp[1], NBD_CMD_DISC, 0, 0, NULL);
+    CHECK(pthread_join(conn.thread, NULL) == 0);
+    CHECK(conn.status == EXIT_SUCCESS);
+    for (i = 0; i < 2; i++)
+        close(sp[i]);
+    bufpool_destroy(conn.pool);
+    printf("%s engine passed\n", name);
+}
+
+int main(void) {
+    struct buse_operations aop;
+
+    memset(&aop, 0, sizeof(aop));
+    aop.read = test_read;
+    aop.write = test_write;
+    aop.write_zeroes = test_write_zeroes;
+    aop.sync_range = test_sync_range;
+    aop.size = IMAGE_SIZE;
+    run("blocking", &aop);
+
+    aop.engine = BUSE_ENGINE_URING;
+    run("io_uring", &aop);
+
+    aop.engine = BUSE_ENGINE_BLOCKING;
+    aop.submit = test_submit;
+    run("async", &aop);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "blockbitmap.hpp"
+#include "busemanager.hpp"
+#include "testutil.hpp"
+
+// Dirty ranges are coalesced into runs of adjacent blocks by the bitmap, and synchronization uploads each run as
+// extents of at most the maximum transfer size.
+
+namespace {
+
+using Runs = std::vector<std::pair<uint64_t, uint64_t>>;
+
+Runs drainRuns(BlockBitmap& bitmap) {
+    Runs runs;
+    bitmap.drain([&runs](uint64_t first, uint64_t count) { runs.emplace_back(first, count); });
+    return runs;
+}
+
+void testBitmapCoalescing() {
+    BlockBitmap bitmap(1000);
+    bitmap.set(10, 5);
+    bitmap.set(12, 10);  // Overlapping
+    bitmap.set(22, 3);   // Adjacent
+    bitmap.set(60, 8);   // Across a word boundary
+    bitmap.set(128, 128);
+    bitmap.set(256, 1);  // Adjacent to whole words
+    bitmap.set(999, 1);
+    CHECK((drainRuns(bitmap) == Runs{{10, 15}, {60, 8}, {128, 129}, {999, 1}}));
+    CHECK(drainRuns(bitmap).empty());
+}
+
+void testSyncedExtents() {
+    constexpr uint64_t MiB = 1024 * 1024;
+    const uint64_t size = 16 * MiB + 1000;  // Ends in a short block
+    BuseManager manager(size);
+    // Extents of three blocks, so every run longer than that is split and the last piece is shorter
+    manager.setSyncPipeline(64 * 1024, 4, 3 * BLOCK_SIZE + 100);
+
+    for (uint64_t offset = 0; offset < MiB; offset += BLOCK_SIZE) {
+        writeBytes(manager, offset, BLOCK_SIZE, 1);
+    }
+    writeBytes(manager, 2 * MiB + 100, 10000, 2);
+    writeBytes(manager, 2 * MiB + 5000, 10000, 3);
+    writeBytes(manager, size - 500, 500, 4);
+    CHECK((manager.changedSince(0) == Runs{{0, MiB}, {2 * MiB, 4 * BLOCK_SIZE}, {size - 1000, 1000}}));
+
+    CHECK(manager.flush());
+    CHECK(manager.isDurable());
+    CHECK(manager.verifyRemote());
+    CHECK(holds(0, MiB, 1));
+    CHECK(holds(2 * MiB + 100, 4900, 2) && holds(2 * MiB + 5000, 10000, 3));
+    CHECK(holds(size - 500, 500, 4));
+
+    // A rewrite inside an uploaded run only ships its own blocks, and the remote ends up with the new data
+    uint64_t epoch = manager.getStartedEpoch();
+    writeBytes(manager, 100 * BLOCK_SIZE + 10, 2 * BLOCK_SIZE, 5);
+    CHECK((manager.changedSince(epoch) == Runs{{100 * BLOCK_SIZE, 3 * BLOCK_SIZE}}));
+    CHECK(manager.flush());
+    CHECK(manager.verifyRemote());
+}
+
+}  // namespace
+
+int main() {
+    loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+    testBitmapCoalescing();
+    testSyncedExtents();
+    std::printf("extent_test passed\n");
+    return 0;
+}
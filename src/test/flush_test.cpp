@@ -0,0 +1,103 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "busemanager.hpp"
+#include "testutil.hpp"
+
+// Flushes complete once the round of the next epoch is durable, wake the synchronization thread instead of
+// waiting for its interval, and fail with their round.
+//
+// Usage: flush_test <path of buse_remote>
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+
+void testInlineFlush() {
+    BuseManager manager(4 * MiB);
+    CHECK(manager.flush());  // Nothing to make durable
+    CHECK(manager.getStartedEpoch() == 0);
+
+    writeBytes(manager, 0, BLOCK_SIZE, 1);
+    CHECK(!manager.isDurable());
+    CHECK(manager.flush());
+    uint64_t epoch = manager.getStartedEpoch();
+    CHECK(epoch == 1 && manager.getDurableEpoch() == epoch);
+    CHECK(manager.isDurable() && manager.changedSince(epoch).empty());
+
+    writeBytes(manager, MiB, BLOCK_SIZE, 2);
+    CHECK(!manager.isDurable(MiB, BLOCK_SIZE) && manager.isDurable(0, BLOCK_SIZE));
+    CHECK(manager.flush());
+    CHECK(manager.getDurableEpoch() == epoch + 1);
+    CHECK(manager.verifyRemote());
+}
+
+void testSyncThread() {
+    constexpr int WRITERS = 20;
+    BuseManager manager(4 * MiB);
+    std::thread syncThread(&BuseManager::runPeriodicSync, &manager);
+
+    // Well below the synchronization interval, as every flush wakes the thread
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (int writer = 0; writer < WRITERS; writer++) {
+        writers.emplace_back([&manager, writer] {
+            for (int i = 0; i < 5; i++) {
+                uint64_t offset = (writer * 8 + i) * BLOCK_SIZE;
+                writeBytes(manager, offset, BLOCK_SIZE, static_cast<char>(writer + 1));
+                CHECK(manager.flush());
+                CHECK(manager.isDurable(offset, BLOCK_SIZE));
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+
+    // Flushes requested as the thread stops still get a round of their own
+    std::atomic<int> completed{0};
+    for (int i = 0; i < 10; i++) {
+        writeBytes(manager, 2 * MiB + i * BLOCK_SIZE, BLOCK_SIZE, 3);
+        manager.flushAsync([&completed](bool durable) {
+            CHECK(durable);
+            completed++;
+        });
+    }
+    manager.stopSyncThread();
+    syncThread.join();
+    CHECK(completed.load() == 10);
+    CHECK(manager.isDurable());
+    CHECK(manager.verifyRemote());
+}
+
+void testFailedFlush(const char* program) {
+    auto server = std::make_unique<RemoteServer>(program, 4 * MiB);
+    BuseManager manager(4 * MiB, "", server->getEndpoint());
+    writeBytes(manager, 0, BLOCK_SIZE, 1);
+    CHECK(manager.flush());
+
+    server.reset();
+    writeBytes(manager, BLOCK_SIZE, BLOCK_SIZE, 2);
+    CHECK(!manager.flush());
+    CHECK(!manager.isDurable());
+    CHECK(manager.changedSince(manager.getDurableEpoch()).size() == 1);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    CHECK(argc == 2);
+    loguru::g_stderr_verbosity = loguru::Verbosity_OFF;  // The failed flush logs errors by design
+    testInlineFlush();
+    testSyncThread();
+    testFailedFlush(argv[1]);
+    std::printf("flush_test passed\n");
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "busemanager.hpp"
+#include "tcpremotestore.hpp"
+#include "testutil.hpp"
+
+// A hydrating device starts from the contents of the remote store, fetching blocks on access and in the
+// background, while writes and trims replace blocks without fetching them.
+//
+// Usage: hydration_test <path of buse_remote>
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+constexpr uint64_t SIZE = 8 * MiB;
+
+// Every third block stays zero, so it is present from the start
+char blockValue(uint64_t block) {
+    return block % 3 == 0 ? 0 : static_cast<char>(block % 120 + 1);
+}
+
+bool matches(const std::vector<char>& expected, uint64_t offset, uint64_t len) {
+    RangeGuard lock(BuseManager::rangeLocks, offset, len, false);
+    return std::memcmp(BuseManager::buffer.get() + offset, expected.data() + offset, len) == 0;
+}
+
+void testHydration(const std::string& endpoint) {
+    std::vector<char> expected(SIZE);
+    for (uint64_t block = 0; block < SIZE / BLOCK_SIZE; block++) {
+        std::memset(expected.data() + block * BLOCK_SIZE, blockValue(block), BLOCK_SIZE);
+    }
+    {
+        TcpRemoteStore remote(endpoint);
+        for (uint64_t offset = 0; offset < SIZE; offset += MiB) {
+            remote.put(offset, expected.data() + offset, MiB);
+        }
+        remote.flush();
+    }
+
+    BuseManager manager(0, "", endpoint, true);
+    CHECK(manager.getBufferSize() == SIZE);
+    CHECK(holds(0, SIZE, 0));  // Only the hashes were fetched up front
+
+    // Reads fault their blocks in
+    CHECK(manager.hydrate(5 * BLOCK_SIZE + 10, 2 * BLOCK_SIZE));
+    CHECK(matches(expected, 5 * BLOCK_SIZE, 3 * BLOCK_SIZE));
+
+    // A partial write keeps the rest of its block, whole blocks and trims need nothing from the remote store
+    writeBytes(manager, 10 * BLOCK_SIZE + 100, 200, 0x7f);
+    std::memset(expected.data() + 10 * BLOCK_SIZE + 100, 0x7f, 200);
+    writeBytes(manager, 20 * BLOCK_SIZE, 2 * BLOCK_SIZE, 0x7e);
+    std::memset(expected.data() + 20 * BLOCK_SIZE, 0x7e, 2 * BLOCK_SIZE);
+    {
+        RangeGuard lock(BuseManager::rangeLocks, 31 * BLOCK_SIZE, BLOCK_SIZE, true);
+        manager.trim(31 * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    std::memset(expected.data() + 31 * BLOCK_SIZE, 0, BLOCK_SIZE);
+    CHECK(manager.hydrate(0, 64 * BLOCK_SIZE));  // Leaves the replaced blocks alone
+    CHECK(matches(expected, 0, 64 * BLOCK_SIZE));
+
+    // Readers fault blocks in while the background threads hydrate the rest
+    manager.startHydration(2);
+    std::vector<std::thread> readers;
+    for (uint64_t reader = 0; reader < 2; reader++) {
+        readers.emplace_back([&, reader] {
+            for (uint64_t offset = (64 + reader * 17) * BLOCK_SIZE; offset < SIZE; offset += 37 * BLOCK_SIZE) {
+                CHECK(manager.hydrate(offset, BLOCK_SIZE));
+                CHECK(matches(expected, offset, BLOCK_SIZE));
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    CHECK(manager.hydrate(0, SIZE));
+    CHECK(matches(expected, 0, SIZE));
+
+    CHECK(manager.flush());
+    CHECK(manager.verifyRemote());
+    TcpRemoteStore remote(endpoint);
+    std::vector<char> block(BLOCK_SIZE);
+    remote.get(10 * BLOCK_SIZE, block.data(), BLOCK_SIZE);
+    CHECK(std::memcmp(block.data(), expected.data() + 10 * BLOCK_SIZE, BLOCK_SIZE) == 0);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    CHECK(argc == 2);
+    loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+    RemoteServer server(argv[1], SIZE);
+    testHydration(server.getEndpoint());
+    std::printf("hydration_test passed\n");
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "busemanager.hpp"
+#include "tcpremotestore.hpp"
+#include "testutil.hpp"
+
+// Forced unit access writes make just their own blocks durable on the remote store, ahead of the next round.
+//
+// Usage: syncrange_test <path of buse_remote>
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+
+bool remoteHolds(RemoteStore& store, uint64_t offset, uint64_t len, char value) {
+    std::vector<char> data(len);
+    store.get(offset, data.data(), static_cast<uint32_t>(len));
+    for (char c : data) {
+        if (c != value)
+            return false;
+    }
+    return true;
+}
+
+void testSyncRange(const std::string& endpoint) {
+    BuseManager manager(16 * MiB, "", endpoint);
+    TcpRemoteStore remote(endpoint);
+    writeBytes(manager, 0, 3 * BLOCK_SIZE, 1);
+    writeBytes(manager, 8 * MiB, 2 * BLOCK_SIZE, 2);
+
+    // Only the blocks covering the range are uploaded
+    CHECK(manager.syncRange(BLOCK_SIZE + 10, 100));
+    CHECK(remoteHolds(remote, 0, BLOCK_SIZE, 0));
+    CHECK(remoteHolds(remote, BLOCK_SIZE, BLOCK_SIZE, 1));
+    CHECK(remoteHolds(remote, 2 * BLOCK_SIZE, BLOCK_SIZE, 0));
+    CHECK(manager.syncRange(0, 3 * BLOCK_SIZE));
+    CHECK(remoteHolds(remote, 0, 3 * BLOCK_SIZE, 1));
+    CHECK(remoteHolds(remote, 8 * MiB, 2 * BLOCK_SIZE, 0));
+
+    // They only count as durable once a round has completed
+    CHECK(!manager.isDurable());
+    CHECK(manager.flush());
+    CHECK(manager.isDurable());
+    CHECK(remoteHolds(remote, 8 * MiB, 2 * BLOCK_SIZE, 2));
+
+    // A forced write zeroes clears the remote blocks without a round
+    {
+        RangeGuard lock(BuseManager::rangeLocks, 8 * MiB, 2 * BLOCK_SIZE, true);
+        manager.zeroRange(8 * MiB, 2 * BLOCK_SIZE);
+    }
+    CHECK(manager.syncRange(8 * MiB, 2 * BLOCK_SIZE));
+    CHECK(remoteHolds(remote, 8 * MiB, 2 * BLOCK_SIZE, 0));
+    CHECK(manager.flush());
+    CHECK(manager.verifyRemote());
+}
+
+// Writers force their own blocks out while rounds run, and always find the remote store holding their last write
+void testConcurrentRounds(const std::string& endpoint) {
+    constexpr int WRITERS = 4;
+    constexpr int WRITES = 50;
+    BuseManager manager(16 * MiB, "", endpoint);
+    std::atomic<int> running{WRITERS};
+    std::thread flusher([&] {
+        while (running.load() != 0) {
+            CHECK(manager.flush());
+        }
+    });
+    std::vector<std::thread> writers;
+    for (int writer = 0; writer < WRITERS; writer++) {
+        writers.emplace_back([&, writer] {
+            TcpRemoteStore remote(endpoint);
+            for (int i = 1; i <= WRITES; i++) {
+                uint64_t offset = (writer * 64 + i % 8) * BLOCK_SIZE;
+                writeBytes(manager, offset, BLOCK_SIZE, static_cast<char>(i));
+                CHECK(manager.syncRange(offset, BLOCK_SIZE));
+                CHECK(remoteHolds(remote, offset, BLOCK_SIZE, static_cast<char>(i)));
+            }
+            running--;
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    flusher.join();
+    CHECK(manager.flush());
+    CHECK(manager.verifyRemote());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    CHECK(argc == 2);
+    loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+    {
+        RemoteServer server(argv[1], 16 * MiB);
+        testSyncRange(server.getEndpoint());
+    }
+    {
+        RemoteServer server(argv[1], 16 * MiB);
+        testConcurrentRounds(server.getEndpoint());
+    }
+    std::printf("syncrange_test passed\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+
+#include "busemanager.hpp"
+#include "tcpremotestore.hpp"
+
+// Shared by the test programs: a check that holds in any build type, the write path of the NBD callbacks and a
+// buse_remote server to test the TCP transport against.
+
+#define CHECK(condition)                                                                          \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);   \
+            std::exit(1);                                                                         \
+        }                                                                                         \
+    } while (0)
+
+/**
+ * @brief Fills a byte range of the device with one value, the way a write request does.
+ */
+inline void writeBytes(BuseManager& manager, uint64_t offset, uint64_t len, char value) {
+    CHECK(manager.hydrateEdges(offset, len));
+    RangeGuard lock(BuseManager::rangeLocks, offset, len, true);
+    manager.prepareWrite(offset, len);
+    std::memset(BuseManager::buffer.get() + offset, value, len);
+    manager.markDirty(offset, len);
+}
+
+/**
+ * @brief Returns whether every byte of a range of the device holds the given value.
+ */
+inline bool holds(uint64_t offset, uint64_t len, char value) {
+    const char* data = BuseManager::buffer.get() + offset;
+    for (uint64_t i = 0; i < len; i++) {
+        if (data[i] != value)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Runs a buse_remote server on a free local port for the lifetime of the object.
+ */
+class RemoteServer {
+   public:
+    /**
+     * @param program The path of the buse_remote executable.
+     * @param size The storage size in bytes.
+     *
+     * Returns once the server accepts connections.
+     */
+    RemoteServer(const char* program, uint64_t size) {
+        std::string port = std::to_string(freePort());
+        endpoint = "127.0.0.1:" + port;
+        std::string sizeArg = std::to_string(size);
+        pid = fork();
+        CHECK(pid != -1);
+        if (pid == 0) {
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            execl(program, program, "-p", port.c_str(), "-s", sizeArg.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        for (int attempt = 0;; attempt++) {
+            try {
+                TcpRemoteStore probe(endpoint);
+                return;
+            } catch (const std::exception&) {
+                CHECK(attempt < 100);
+                usleep(50 * 1000);
+            }
+        }
+    }
+    ~RemoteServer() {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+
+    RemoteServer(const RemoteServer&) = delete;
+    RemoteServer& operator=(const RemoteServer&) = delete;
+
+    /**
+     * @brief Returns the host:port to connect to.
+     */
+    const std::string& getEndpoint() const { return endpoint; }
+
+   private:
+    pid_t pid;
+    std::string endpoint;
+
+    static uint16_t freePort() {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        CHECK(fd != -1);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addrLen = sizeof(addr);
+        CHECK(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+        CHECK(getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addrLen) == 0);
+        close(fd);
+        return ntohs(addr.sin_port);
+    }
+};
+
+#endif  // TEST_UTIL_H
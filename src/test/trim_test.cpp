@@ -0,0 +1,86 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "busemanager.hpp"
+#include "testutil.hpp"
+
+// Trims release the whole blocks they cover, leave partial blocks alone and are cleared on the remote store
+// with zero requests.
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+
+using Runs = std::vector<std::pair<uint64_t, uint64_t>>;
+
+uint64_t allocatedBytes(const std::string& path) {
+    struct stat st;
+    CHECK(stat(path.c_str(), &st) == 0);
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+void trim(BuseManager& manager, uint64_t offset, uint64_t len) {
+    RangeGuard lock(BuseManager::rangeLocks, offset, len, true);
+    manager.trim(offset, len);
+}
+
+void testTrim() {
+    BuseManager manager(8 * MiB);
+    writeBytes(manager, 0, 6 * MiB, 7);
+    CHECK(manager.flush());
+
+    // Only the whole blocks between the edges are released
+    uint64_t epoch = manager.getStartedEpoch();
+    trim(manager, 100, 2 * MiB);
+    CHECK((manager.changedSince(epoch) == Runs{{BLOCK_SIZE, 2 * MiB - BLOCK_SIZE}}));
+    CHECK(holds(0, BLOCK_SIZE, 7));
+    CHECK(holds(BLOCK_SIZE, 2 * MiB - BLOCK_SIZE, 0));
+    CHECK(holds(2 * MiB, 100, 7));
+    CHECK(manager.flush());
+    CHECK(manager.verifyRemote());
+
+    // A block written again after its trim in the same round keeps the new data on the remote store
+    trim(manager, 4 * MiB, MiB);
+    writeBytes(manager, 4 * MiB + 2 * BLOCK_SIZE, BLOCK_SIZE, 9);
+    CHECK(manager.flush());
+    CHECK(manager.verifyRemote());
+    CHECK(holds(4 * MiB, 2 * BLOCK_SIZE, 0));
+    CHECK(holds(4 * MiB + 2 * BLOCK_SIZE, BLOCK_SIZE, 9));
+    CHECK(holds(4 * MiB + 3 * BLOCK_SIZE, MiB - 3 * BLOCK_SIZE, 0));
+}
+
+void testImageHoles() {
+    const std::string image = "trim_test_" + std::to_string(getpid()) + ".img";
+    unlink(image.c_str());
+    {
+        BuseManager manager(8 * MiB, image);
+        writeBytes(manager, 0, 4 * MiB, 7);
+        BuseManager::buffer.sync();
+        uint64_t written = allocatedBytes(image);
+        CHECK(written >= 4 * MiB);
+
+        trim(manager, MiB, 2 * MiB);
+        BuseManager::buffer.sync();
+        CHECK(allocatedBytes(image) <= written - 2 * MiB);
+        CHECK(holds(MiB, 2 * MiB, 0));
+        CHECK(manager.flush());
+        CHECK(manager.verifyRemote());
+    }
+    unlink(image.c_str());
+}
+
+}  // namespace
+
+int main() {
+    loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+    testTrim();
+    testImageHoles();
+    std::printf("trim_test passed\n");
+    return 0;
+}
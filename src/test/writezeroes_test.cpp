@@ -0,0 +1,114 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <loguru.hpp>
+
+#include "busemanager.hpp"
+#include "testutil.hpp"
+
+// Write zeroes clears exactly the requested bytes: whole blocks are recorded as a range and cleared remotely
+// without a payload, deallocated unless NBD_CMD_FLAG_NO_HOLE keeps them, and the edges are synced as writes.
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+
+using Runs = std::vector<std::pair<uint64_t, uint64_t>>;
+
+uint64_t allocatedBytes(const std::string& path) {
+    struct stat st;
+    CHECK(stat(path.c_str(), &st) == 0);
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+void removeDir(const std::string& dir) {
+    if (DIR* listing = opendir(dir.c_str())) {
+        while (struct dirent* entry = readdir(listing)) {
+            if (entry->d_name[0] != '.')
+                unlink((dir + "/" + entry->d_name).c_str());
+        }
+        closedir(listing);
+    }
+    rmdir(dir.c_str());
+}
+
+void zeroRange(BuseManager& manager, uint64_t offset, uint64_t len, bool keepAllocated) {
+    RangeGuard lock(BuseManager::rangeLocks, offset, len, true);
+    manager.zeroRange(offset, len, keepAllocated);
+}
+
+void testZeroRange() {
+    const uint64_t size = 8 * MiB + 1000;  // Ends in a short block
+    BuseManager manager(size);
+    writeBytes(manager, 0, size, 7);
+    CHECK(manager.flush());
+
+    uint64_t epoch = manager.getStartedEpoch();
+    zeroRange(manager, 100, MiB, false);
+    CHECK((manager.changedSince(epoch) == Runs{{0, MiB + BLOCK_SIZE}}));
+    CHECK(holds(0, 100, 7));
+    CHECK(holds(100, MiB, 0));
+    CHECK(holds(MiB + 100, 100, 7));
+
+    // Within a single block, and over the short last block
+    zeroRange(manager, 2 * MiB + 10, 20, false);
+    zeroRange(manager, size - 1500, 1500, true);
+    CHECK(holds(2 * MiB, 10, 7) && holds(2 * MiB + 10, 20, 0) && holds(2 * MiB + 30, 100, 7));
+    CHECK(holds(size - 1600, 100, 7) && holds(size - 1500, 1500, 0));
+    CHECK(manager.flush());
+    CHECK(manager.verifyRemote());
+}
+
+void testNoHole() {
+    const std::string image = "writezeroes_test_" + std::to_string(getpid()) + ".img";
+    const std::string journal = "writezeroes_test_" + std::to_string(getpid()) + ".journal";
+    unlink(image.c_str());
+    removeDir(journal);
+    {
+        BuseManager manager(8 * MiB, image);
+        manager.openJournal(journal, true);
+        writeBytes(manager, 0, 4 * MiB, 7);
+        CHECK(manager.commitWrite());
+        BuseManager::buffer.sync();
+        uint64_t written = allocatedBytes(image);
+
+        // NO_HOLE zeroes in place, so the image keeps its blocks; without it they are punched out
+        zeroRange(manager, 0, 2 * MiB, true);
+        CHECK(manager.commitWrite());
+        BuseManager::buffer.sync();
+        CHECK(allocatedBytes(image) == written);
+        zeroRange(manager, 2 * MiB, MiB, false);
+        CHECK(manager.commitWrite());
+        BuseManager::buffer.sync();
+        CHECK(allocatedBytes(image) <= written - MiB);
+        CHECK(holds(0, 3 * MiB, 0) && holds(3 * MiB, MiB, 7));
+    }  // No round ran, so the journal still holds every record
+
+    // Replayed onto a fresh image, the journal restores the zeroed blocks allocated and the deallocated ones not
+    unlink(image.c_str());
+    {
+        BuseManager manager(8 * MiB, image);
+        manager.openJournal(journal, true);
+        CHECK(holds(0, 3 * MiB, 0) && holds(3 * MiB, MiB, 7));
+        BuseManager::buffer.sync();
+        uint64_t allocated = allocatedBytes(image);
+        CHECK(allocated >= 3 * MiB && allocated < 4 * MiB);
+    }
+    unlink(image.c_str());
+    removeDir(journal);
+}
+
+}  // namespace
+
+int main() {
+    loguru::g_stderr_verbosity = loguru::Verbosity_WARNING;
+    testZeroRange();
+    testNoHole();
+    std::printf("writezeroes_test passed\n");
+    return 0;
+}